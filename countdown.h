@@ -0,0 +1,57 @@
+/*
+  MIT License
+
+  Copyright (c) 2022 Delta Z Technical Services, LLC, Austin, TX.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+/*
+  The countdown the 1 kHz Timer1 tick runs.  Each tick adds its real length, tick_q24
+  Q24 fixed-point milliseconds (TICK_Q24_NOMINAL for exactly 1 ms; clock calibration
+  trims it), to a fraction, and takes the whole milliseconds off the count.  The tick
+  that reaches zero stops it and latches expired, for loop() to see.
+
+  Nothing here touches the hardware, so a host can drive it from a simulated time
+  source (time-source.h).
+*/
+
+#define TICK_Q24_NOMINAL (1UL << 24)
+
+struct countdown {
+  int32_t millis;
+  uint32_t fraction_q24; // part of a millisecond carried to the next tick
+  bool running;
+  bool expired; // latched at zero
+};
+
+/* One tick; true on the tick that reaches zero. */
+static inline bool countdown_step(volatile struct countdown *countdown, uint32_t tick_q24) {
+  if(!countdown->running)
+    return false;
+  uint32_t fraction_q24 = countdown->fraction_q24 + tick_q24;
+  countdown->fraction_q24 = fraction_q24 & 0x00ffffff;
+  if((countdown->millis -= (uint8_t)(fraction_q24 >> 24)) > 0)
+    return false;
+  countdown->millis = 0;
+  countdown->running = false;
+  countdown->expired = true;
+  return true;
+}
@@ -0,0 +1,118 @@
+/*
+  MIT License
+
+  Copyright (c) 2022 Delta Z Technical Services, LLC, Austin, TX.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+/*
+  Bit-parallel button debouncer.  Each bit of a byte is one input; a 2-bit vertical
+  counter per bit (bit 0 of the count in ct0, bit 1 in ct1) counts consecutive samples
+  that disagree with the debounced level.  Any sample that agrees resets that bit's
+  count, so a bit only toggles after DEBOUNCE_SAMPLES disagreeing samples in a row, and
+  all eight inputs cost the same handful of logic operations as one.
+
+  Stable time is DEBOUNCE_SAMPLES times the sample interval.  Nothing here touches the
+  hardware, so bounce traces can be fed through debounce_sample() on a host.
+*/
+
+#define DEBOUNCE_SAMPLES 4 // fixed by the 2-bit counters
+
+struct debouncer {
+  uint8_t level; // debounced levels
+  uint8_t ct0; // vertical counter, low bits
+  uint8_t ct1; // vertical counter, high bits
+};
+
+static inline void debounce_reset(struct debouncer *d, uint8_t level) {
+  d->level = level;
+  d->ct0 = 0xff; // idle count is 3 in every bit
+  d->ct1 = 0xff;
+}
+
+/* Feed one sample of the raw inputs; returns the bits whose debounced level toggled. */
+static inline uint8_t debounce_sample(struct debouncer *d, uint8_t raw) {
+  uint8_t disagree = d->level ^ raw;
+  d->ct0 = ~(d->ct0 & disagree); // agreeing bits go back to 3, disagreeing ones count down
+  d->ct1 = d->ct0 ^ (d->ct1 & disagree);
+  uint8_t toggled = disagree & d->ct0 & d->ct1; // counted down through 0 back to 3
+  d->level ^= toggled;
+  return toggled;
+}
+
+/* True while some input disagrees with its debounced level and the counters are busy. */
+static inline bool debounce_pending(struct debouncer *d, uint8_t raw) {
+  return (d->level ^ raw) != 0;
+}
+
+/*
+  Edge stamps, one per input, so a debounced event can carry the time of the first edge
+  of its own burst, whatever other inputs are doing.  debounce_edge() runs on every pin
+  change: an input that has started to disagree with its debounced level is stamped,
+  unless it has a stamp from earlier in the same burst.  debounce_stamp_sample() runs
+  after each debounce_sample(), and returns the earliest stamp among the inputs that
+  toggled (now, if none had one).  It drops the stamps of those, and of any input that
+  agrees again with no edge since the last sample: a glitch that came to nothing.  The
+  sampler can sleep before it sees that, so a stamp older than any bounce is stale too.
+*/
+#define DEBOUNCE_STAMP_MAX_MICROS 20000L
+struct debounce_stamps {
+  uint8_t raw; // inputs at the last edge
+  uint8_t stamped;
+  uint8_t edged; // inputs that changed since the last sample
+  uint32_t micros[8];
+};
+
+static inline void debounce_stamps_reset(struct debounce_stamps *s, uint8_t raw) {
+  s->raw = raw;
+  s->stamped = 0;
+  s->edged = 0;
+}
+
+static inline void debounce_edge(const struct debouncer *d, struct debounce_stamps *s,
+				 uint8_t raw, uint32_t now) {
+  s->edged |= raw ^ s->raw;
+  s->raw = raw;
+  uint8_t disagree = d->level ^ raw;
+  for(uint8_t i = 0; disagree != 0; i++, disagree >>= 1) {
+    uint8_t input = 1 << i;
+    if(!(disagree & 1))
+      continue;
+    if(!(s->stamped & input) || now - s->micros[i] > DEBOUNCE_STAMP_MAX_MICROS) {
+      s->micros[i] = now;
+      s->stamped |= input;
+    }
+  }
+}
+
+static inline uint32_t debounce_stamp_sample(const struct debouncer *d, struct debounce_stamps *s,
+					     uint8_t raw, uint8_t toggled, uint32_t now) {
+  uint32_t earliest = now;
+  uint8_t stamped = toggled & s->stamped;
+  for(uint8_t i = 0; stamped != 0; i++, stamped >>= 1) {
+    if((stamped & 1) && (int32_t)(s->micros[i] - earliest) < 0)
+      earliest = s->micros[i];
+  }
+  uint8_t settled = ~(d->level ^ raw) & ~s->edged;
+  s->stamped &= ~(toggled | settled);
+  s->edged = 0;
+  return earliest;
+}
@@ -0,0 +1,75 @@
+/*
+  MIT License
+
+  Copyright (c) 2022 Delta Z Technical Services, LLC, Austin, TX.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Geometry of one NeoPixel digit on the front of the clock, as compile-time parameters.
+
+  The wiring order gives the position of each segment along the LED string, a nibble
+  per segment, in SEGMENT_A..SEGMENT_G order.  It is unpacked at compile time into a
+  PROGMEM table of each segment's first pixel, so pixel() is one table read and an add:
+  shifting the packed order by a run-time amount would be a loop on the AVR.
+
+  The indicator pixel is the one lit while the clock is running.
+*/
+
+#define WIRING_ORDER(a, b, c, d, e, f, g)				\
+  ((uint32_t)(a) | ((uint32_t)(b) << 4) | ((uint32_t)(c) << 8) |	\
+   ((uint32_t)(d) << 12) | ((uint32_t)(e) << 16) | ((uint32_t)(f) << 20) | \
+   ((uint32_t)(g) << 24))
+
+#define WIRING_ORDER_SPIRAL_FROM_E WIRING_ORDER(4, 3, 2, 1, 0, 5, 6)
+
+template <uint8_t PIXELS_PER_SEGMENT, uint32_t WIRING, uint8_t INDICATOR_PIXEL>
+struct digit_geometry {
+  static_assert(INDICATOR_PIXEL >= 7 * PIXELS_PER_SEGMENT, "indicator pixel overlaps a segment");
+
+  enum {
+    pixels_per_segment = PIXELS_PER_SEGMENT,
+    indicator_pixel = INDICATOR_PIXEL,
+    led_count = INDICATOR_PIXEL + 1
+  };
+
+  static const uint8_t first_pixel[7] PROGMEM;
+
+  static inline uint8_t pixel(uint8_t segment, uint8_t offset) {
+    return pgm_read_byte(&first_pixel[segment]) + offset;
+  }
+};
+
+#define WIRING_FIRST_PIXEL(segment) (PIXELS_PER_SEGMENT * ((WIRING >> (4 * (segment))) & 0x0f))
+
+template <uint8_t PIXELS_PER_SEGMENT, uint32_t WIRING, uint8_t INDICATOR_PIXEL>
+const uint8_t digit_geometry<PIXELS_PER_SEGMENT, WIRING, INDICATOR_PIXEL>::first_pixel[7] PROGMEM =
+  {
+   WIRING_FIRST_PIXEL(0), WIRING_FIRST_PIXEL(1), WIRING_FIRST_PIXEL(2), WIRING_FIRST_PIXEL(3),
+   WIRING_FIRST_PIXEL(4), WIRING_FIRST_PIXEL(5), WIRING_FIRST_PIXEL(6)
+  };
+
+#undef WIRING_FIRST_PIXEL
+
+#if CLOCK_BUILD == CLOCK_BUILD_8_PIXEL
+typedef digit_geometry<8, WIRING_ORDER_SPIRAL_FROM_E, 56> front_digit;
+#else
+typedef digit_geometry<7, WIRING_ORDER_SPIRAL_FROM_E, 49> front_digit;
+#endif
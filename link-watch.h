@@ -0,0 +1,84 @@
+/*
+  MIT License
+
+  Copyright (c) 2022 Delta Z Technical Services, LLC, Austin, TX.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+/*
+  Link loss.  A broadcaster that has sent nothing for most of RADIO_HEARTBEAT_MILLIS sends
+  a heartbeat, so its listeners hear from it at least that often even with the clock
+  stopped.  The check runs every RADIO_HEARTBEAT_CHECK_MILLIS, so that is one 17 byte
+  packet every 750-1000 ms: with its ACK, about 0.2% of the air at 250 kbps (0.3% in
+  multicast), and none at all while the running clock is sending anyway.  A listener
+  that hears nothing valid for its link loss window holds its clock and puts "--" and
+  the number of losses over it, on LAYER_STATUS; the next valid packet takes it away.  It
+  shows 2-3 s after the broadcaster goes; test/test-link-loss.cpp has the numbers, and
+  the false alarms at high loss.
+
+  Nothing here touches the hardware, so the decisions can be run against a lossy link on
+  a host.
+*/
+
+#define RADIO_HEARTBEAT_MILLIS 1000
+#define RADIO_HEARTBEAT_CHECK_MILLIS 250
+#define DEFAULT_LINK_LOSS_MILLIS 3000
+
+/* Broadcaster, every RADIO_HEARTBEAT_CHECK_MILLIS: true if it has been quiet long enough. */
+static inline bool heartbeat_due(uint32_t now_millis, uint32_t last_sent_millis) {
+  return now_millis - last_sent_millis >= RADIO_HEARTBEAT_MILLIS - RADIO_HEARTBEAT_CHECK_MILLIS;
+}
+
+struct link_watch {
+  uint32_t last_contact_millis; // the last valid packet
+  uint16_t losses;
+  bool lost;
+};
+
+static inline uint32_t link_loss_window(int16_t link_loss_millis) {
+  // anything shorter than a heartbeat would call every quiet second a loss
+  return link_loss_millis > RADIO_HEARTBEAT_MILLIS ? link_loss_millis : RADIO_HEARTBEAT_MILLIS;
+}
+
+/* Listener, on a valid packet: true if it brings a lost link back. */
+static inline bool link_watch_contact(struct link_watch *watch, uint32_t now_millis) {
+  watch->last_contact_millis = now_millis;
+  bool back = watch->lost;
+  watch->lost = false;
+  return back;
+}
+
+/* How long until the silence is a loss; 0 once it is. */
+static inline uint32_t link_watch_remaining(const struct link_watch *watch, uint32_t now_millis,
+					    int16_t link_loss_millis) {
+  uint32_t silent = now_millis - watch->last_contact_millis;
+  uint32_t window = link_loss_window(link_loss_millis);
+  return silent < window ? window - silent : 0;
+}
+
+/* Listener, when the window may have run out: true if the link is newly lost. */
+static inline bool link_watch_expired(struct link_watch *watch, uint32_t now_millis, int16_t link_loss_millis) {
+  if(watch->lost || link_watch_remaining(watch, now_millis, link_loss_millis) > 0)
+    return false;
+  watch->lost = true;
+  watch->losses++;
+  return true;
+}
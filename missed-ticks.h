@@ -0,0 +1,48 @@
+/*
+  MIT License
+
+  Copyright (c) 2022 Delta Z Technical Services, LLC, Austin, TX.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Adafruit_NeoPixel::show() holds interrupts off while it clocks out a string, 10 us a
+  byte at 800 kHz, so a front digit takes about 1.5 ms.  Timer1 keeps counting through
+  that, but only one compare match can be left pending, and any more are lost: the
+  countdown, the horn and the debouncer would all run slow while the front refreshes.
+
+  Reading TCNT1 just before and after the show gives where in the tick it started and
+  ended.  The show's known length picks how many times the counter wrapped in between;
+  it only has to be right to within half a tick.  One match runs the ISR as soon as
+  interrupts are back on, and the rest are missed.  Nothing here touches the hardware,
+  so it is tested on a host.
+*/
+
+#define TIMER1_TICK_COUNTS 250 // OCR1A + 1: 4 us counts in each 1 ms tick
+#define TIMER1_MICROS_PER_COUNT 4
+#define NEOPIXEL_MICROS_PER_BYTE 10
+
+static inline uint8_t missed_timer1_ticks(uint8_t before, uint8_t after, uint16_t show_counts) {
+  int16_t wrapped_counts = (int16_t)before + show_counts - after;
+  if(wrapped_counts < TIMER1_TICK_COUNTS / 2)
+    return 0;
+  uint8_t matches = (wrapped_counts + TIMER1_TICK_COUNTS / 2) / TIMER1_TICK_COUNTS;
+  return matches - 1;
+}
@@ -0,0 +1,232 @@
+/*
+  MIT License
+
+  Copyright (c) 2022 Delta Z Technical Services, LLC, Austin, TX.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  The radio wire format.  A packet is packed by hand, little-endian, so its layout does
+  not depend on the compiler, and ends in a CRC-16 (CCITT: polynomial 0x1021, initial
+  value 0xffff) over everything before it.  The 8-bit sum it replaces missed swapped
+  bytes and most multi-bit errors.  The high nibble of the first byte is the format
+  version, and a listener drops any version it doesn't know.
+
+  Commands are a bit each, so one packet can carry a start, a beep and the time
+  together.  Clock time goes in 10 ms units, all the rear display's hundredths need.
+
+  byte  0      version << 4 | flags
+  bytes 1-2    sequence number
+  bytes 3-4    clock time, 10 ms units, signed
+  byte  5      command bits, RADIO_COMMAND_BIT()
+  byte  6      radio channel: the current one, or where a channel switch goes
+  bytes 7-10   send_micros
+  bytes 11-14  offset_micros
+  bytes 15-16  CRC-16
+
+  Nothing here touches the hardware, so packets can be round-tripped and corrupted on a
+  host.
+*/
+
+#define RADIO_PACKET_VERSION 2
+#define RADIO_PACKET_SIZE 17
+
+/*
+  Air time at the clock's 250 kbps: preamble, 5 byte address, 9 bit packet control
+  field, payload and 16 bit CRC, plus 130 us for the transceiver to settle before it
+  sends or turns around to listen.  A packet takes about 0.97 ms.
+*/
+#define RADIO_MICROS_PER_BIT 4
+#define RADIO_TURNAROUND_MICROS 130
+#define RADIO_AIR_MICROS(payload) ((8 + 40 + 9 + (payload) * 8 + 16) * RADIO_MICROS_PER_BIT + RADIO_TURNAROUND_MICROS)
+
+#define RADIO_FLAG_CLOCK_RUNNING 0x01
+#define RADIO_FLAG_MULTICAST     0x02 // sent without an ACK, so don't load an ACK payload
+
+#define RADIO_COMMAND_BIT(command) (1 << ((command) - 1))
+
+#define RADIO_DECODE_OK          0
+#define RADIO_DECODE_BAD_LENGTH  1
+#define RADIO_DECODE_BAD_CRC     2
+#define RADIO_DECODE_BAD_VERSION 3
+
+struct radio_message {
+  uint16_t message_serial_number;
+  uint8_t commands; // RADIO_COMMAND_BIT()s
+  uint8_t clock_running;
+  uint8_t multicast;
+  uint8_t channel;
+  int32_t clock_millis; // rounded to 10 ms on the air
+  uint32_t send_micros; // broadcaster micros() when clock_millis was stamped
+  int32_t offset_micros; // broadcaster's estimate of listener micros() - its own, or SYNC_OFFSET_UNKNOWN
+};
+
+static inline void put_radio_16(uint8_t *p, uint16_t value) {
+  p[0] = value;
+  p[1] = value >> 8;
+}
+
+static inline void put_radio_32(uint8_t *p, uint32_t value) {
+  put_radio_16(p, value);
+  put_radio_16(p + 2, value >> 16);
+}
+
+static inline uint16_t get_radio_16(const uint8_t *p) {
+  return p[0] | ((uint16_t)p[1] << 8);
+}
+
+static inline uint32_t get_radio_32(const uint8_t *p) {
+  return get_radio_16(p) | ((uint32_t)get_radio_16(p + 2) << 16);
+}
+
+static inline uint16_t crc16_ccitt(const uint8_t *b, uint8_t size) {
+  uint16_t crc = 0xffff;
+  for(uint8_t i = 0; i < size; i++) {
+    crc ^= (uint16_t)b[i] << 8;
+    for(uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+static inline void encode_radio_message(const struct radio_message *m, uint8_t *packet) {
+  int32_t centis = (m->clock_millis >= 0 ? m->clock_millis + 5 : m->clock_millis - 5) / 10;
+  packet[0] = (RADIO_PACKET_VERSION << 4) | (m->clock_running ? RADIO_FLAG_CLOCK_RUNNING : 0) |
+    (m->multicast ? RADIO_FLAG_MULTICAST : 0);
+  put_radio_16(packet + 1, m->message_serial_number);
+  put_radio_16(packet + 3, (uint16_t)(int16_t)centis);
+  packet[5] = m->commands;
+  packet[6] = m->channel;
+  put_radio_32(packet + 7, m->send_micros);
+  put_radio_32(packet + 11, (uint32_t)m->offset_micros);
+  put_radio_16(packet + 15, crc16_ccitt(packet, RADIO_PACKET_SIZE - 2));
+}
+
+/* Returns RADIO_DECODE_OK and fills in *m, or why the packet was dropped. */
+static inline uint8_t decode_radio_message(const uint8_t *packet, uint8_t length, struct radio_message *m) {
+  if(length != RADIO_PACKET_SIZE)
+    return RADIO_DECODE_BAD_LENGTH;
+  if(get_radio_16(packet + 15) != crc16_ccitt(packet, RADIO_PACKET_SIZE - 2))
+    return RADIO_DECODE_BAD_CRC;
+  if((packet[0] >> 4) != RADIO_PACKET_VERSION)
+    return RADIO_DECODE_BAD_VERSION;
+
+  m->clock_running = (packet[0] & RADIO_FLAG_CLOCK_RUNNING) ? 1 : 0;
+  m->multicast = (packet[0] & RADIO_FLAG_MULTICAST) ? 1 : 0;
+  m->message_serial_number = get_radio_16(packet + 1);
+  m->clock_millis = (int32_t)(int16_t)get_radio_16(packet + 3) * 10;
+  m->commands = packet[5];
+  m->channel = packet[6];
+  m->send_micros = get_radio_32(packet + 7);
+  m->offset_micros = (int32_t)get_radio_32(packet + 11);
+  return RADIO_DECODE_OK;
+}
+
+/*
+  A listener's place in the broadcaster's sequence numbers.  Multicast copies and ACK
+  retries of a packet all carry its sequence number, so a listener takes the first copy
+  it hears and drops the rest.
+*/
+#define MAX_RADIO_SEQUENCE_GAP 100 // more missed than this is a restart, not loss
+
+struct radio_sequence {
+  uint16_t last; // last packet taken
+  bool started;
+};
+
+/*
+  Returns false for a copy of the last packet taken; otherwise takes it and adds any
+  sequence numbers skipped over to *lost.
+*/
+static inline bool take_radio_sequence(struct radio_sequence *s, uint16_t sequence, uint16_t *lost) {
+  if(s->started && sequence == s->last)
+    return false;
+  uint16_t gap = sequence - s->last - 1;
+  if(s->started && gap <= MAX_RADIO_SEQUENCE_GAP)
+    *lost += gap;
+  s->last = sequence;
+  s->started = true;
+  return true;
+}
+
+/*
+  The ACK payload a listener loads for the broadcaster: the times for NTP-style sync
+  (shot-clock.h), then the listener's status, for the broadcaster to keep per listener
+  id.  It rides on ACKs that go anyway, so it costs no transactions of its own, but it
+  is as of the packet before the one it answers.  Packed by hand, like a packet.
+
+  bytes 0-1    sequence number the times are for
+  bytes 2-5    send_micros, echoed
+  bytes 6-9    receive_micros
+  byte  10     listener id
+  bytes 11-12  last sequence number taken
+  bytes 13-14  time shown, 10 ms units, signed
+  byte  15     LISTENER_FLAG_*
+  bytes 16-17  slowest loop() pass, micros
+  byte  18     celsius, signed
+  byte  19     reset cause
+*/
+#define RADIO_ACK_SIZE 20
+
+#define LISTENER_FLAG_RUNNING 0x01
+
+struct radio_ack {
+  uint16_t message_serial_number; // the packet the times are for
+  uint32_t send_micros; // its t1, echoed
+  uint32_t receive_micros; // t2, listener micros() when read
+  uint8_t listener_id; // 0 for a listener without one
+  uint16_t accepted_serial; // last sequence number it took
+  int16_t displayed_centis; // the time it shows, 10 ms units
+  uint8_t flags; // LISTENER_FLAG_*
+  uint16_t loop_max_micros; // slowest loop() pass, saturating
+  int8_t celsius; // or TEMP_NOT_READ
+  uint8_t reset_cause; // MCUSR at boot
+};
+
+static inline void encode_radio_ack(const struct radio_ack *a, uint8_t *payload) {
+  put_radio_16(payload, a->message_serial_number);
+  put_radio_32(payload + 2, a->send_micros);
+  put_radio_32(payload + 6, a->receive_micros);
+  payload[10] = a->listener_id;
+  put_radio_16(payload + 11, a->accepted_serial);
+  put_radio_16(payload + 13, (uint16_t)a->displayed_centis);
+  payload[15] = a->flags;
+  put_radio_16(payload + 16, a->loop_max_micros);
+  payload[18] = (uint8_t)a->celsius;
+  payload[19] = a->reset_cause;
+}
+
+/* Returns false, leaving *a alone, for a payload of the wrong length. */
+static inline bool decode_radio_ack(const uint8_t *payload, uint8_t length, struct radio_ack *a) {
+  if(length != RADIO_ACK_SIZE)
+    return false;
+  a->message_serial_number = get_radio_16(payload);
+  a->send_micros = get_radio_32(payload + 2);
+  a->receive_micros = get_radio_32(payload + 6);
+  a->listener_id = payload[10];
+  a->accepted_serial = get_radio_16(payload + 11);
+  a->displayed_centis = (int16_t)get_radio_16(payload + 13);
+  a->flags = payload[15];
+  a->loop_max_micros = get_radio_16(payload + 16);
+  a->celsius = (int8_t)payload[18];
+  a->reset_cause = payload[19];
+  return true;
+}
@@ -0,0 +1,92 @@
+/*
+  MIT License
+
+  Copyright (c) 2022 Delta Z Technical Services, LLC, Austin, TX.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+/*
+  A listener's copy of the broadcaster's clock.  The listener runs its own countdown
+  between packets and takes each packet as a correction.  Small errors are slewed out
+  by running up to 1/REMOTE_SLEW_DIVISOR fast or slow, so a running display never counts
+  back up; anything over REMOTE_SNAP_MILLIS (a reset, time+ or time-) is taken at once.
+
+  Nothing here touches the hardware: the caller passes in the time, so a lossy link can
+  be simulated on a host.
+*/
+
+#define REMOTE_SNAP_MILLIS 500
+#define REMOTE_SLEW_DIVISOR 8
+
+struct remote_clock {
+  int32_t millis;
+  int32_t slew_millis; // correction still to run out
+  uint32_t slew_credit; // elapsed millis not yet used for slewing
+  uint32_t updated_millis; // when millis was last advanced
+  int32_t last_error_millis;
+  uint16_t corrections;
+  uint16_t snaps;
+  bool running;
+};
+
+static inline void advance_remote_clock(struct remote_clock *clock, uint32_t now_millis) {
+  uint32_t elapsed = now_millis - clock->updated_millis;
+  clock->updated_millis = now_millis;
+  if(!clock->running)
+    return;
+
+  // passes are often shorter than REMOTE_SLEW_DIVISOR ms, so carry the remainder over
+  clock->slew_credit += elapsed;
+  int32_t max_slew = clock->slew_credit / REMOTE_SLEW_DIVISOR;
+  int32_t slew = clock->slew_millis;
+  if(slew > max_slew)
+    slew = max_slew;
+  else if(slew < -max_slew)
+    slew = -max_slew;
+  if(slew == clock->slew_millis) {
+    clock->slew_credit = 0; // all caught up; don't bank credit for a later burst
+  } else {
+    clock->slew_credit -= (slew < 0 ? -slew : slew) * REMOTE_SLEW_DIVISOR;
+  }
+  clock->slew_millis -= slew;
+  clock->millis -= (int32_t)elapsed - slew;
+  if(clock->millis < 0)
+    clock->millis = 0; // hold at zero until the broadcaster says it stopped
+}
+
+static inline void correct_remote_clock(struct remote_clock *clock, uint32_t now_millis,
+					int32_t clock_millis, bool clock_running) {
+  advance_remote_clock(clock, now_millis);
+  int32_t error = clock_millis - clock->millis;
+  clock->last_error_millis = error;
+  clock->corrections++;
+
+  if(!clock_running || !clock->running || error > REMOTE_SNAP_MILLIS || error < -REMOTE_SNAP_MILLIS) {
+    // stopped, just started, or a real change of time: show it as it is
+    clock->millis = clock_millis;
+    clock->slew_millis = 0;
+    clock->snaps++;
+  } else {
+    // replaces whatever was left of the last correction: this one is newer
+    clock->slew_millis = error;
+  }
+  clock->running = clock_running;
+}
@@ -25,6 +25,8 @@
 #define SERIAL_DEBUG
 
 #include <avr/wdt.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
 #include <EEPROM.h>
 #include <Wire.h>
 #include <Adafruit_NeoPixel.h>
@@ -32,7 +34,15 @@
 #include <nRF24L01.h>
 #include <RF24.h>
 #include <TM1637Display.h>
+#include "radio-packet.h" // struct radio_ack, for shot-clock.h
 #include "shot-clock.h"
+#include "digit-geometry.h"
+#include "debounce.h"
+#include "missed-ticks.h"
+#include "countdown.h"
+#include "time-source.h"
+#include "remote-clock.h"
+#include "link-watch.h"
 #include "command-processor.h"
 #include "shot-clock-commands.h"
 
@@ -41,11 +51,35 @@ extern char output_buf[];
 bool g_debug = false; // turn on in places start debug output after a certain event
 
 int32_t g_clock_millis = 0;
-int32_t g_last_clock_millis = 0;
 bool g_clock_is_running = false;
-bool g_remote_clock_is_running = false;
 
-uint32_t g_last_loop_millis = 0;
+/*
+  While the clock runs, the countdown is kept by a 1 kHz Timer1 compare interrupt, so a
+  slow loop() iteration can't delay reaching zero or the horn.  loop() only copies the
+  count into g_clock_millis for display, in update_clock_millis().
+*/
+volatile struct countdown g_countdown = { 0 }; // run by the ISR; expired is latched at zero
+volatile uint32_t g_countdown_zero_micros = 0;
+volatile uint32_t g_tick_q24 = TICK_Q24_NOMINAL; // real length of one tick
+
+/* EEPROM saved clock calibration */
+int16_t g_clock_ppm = 0;
+int8_t g_clock_cal_celsius = DEFAULT_CLOCK_CAL_CELSIUS;
+int8_t g_clock_tempco = 0;
+int8_t g_clock_celsius = TEMP_NOT_READ; // last reading used for compensation
+
+uint8_t g_reset_cause = 0; // MCUSR at boot: power on, external, brown out or watchdog
+
+/* calibration run against a reference clock */
+uint8_t g_calibration_samples = 0;
+int32_t g_calibration_first_reference = 0;
+int32_t g_calibration_last_reference = 0;
+uint32_t g_calibration_last_micros = 0;
+uint32_t g_calibration_local_millis = 0;
+uint16_t g_calibration_local_micros = 0;
+uint32_t g_zero_to_stop_micros = 0; // how long the loop took to notice zero
+struct remote_clock g_remote_clock = { 0 }; // the listener's copy of the broadcaster's clock
+
 int32_t g_custom_reset_millis = 20000;
 
 bool g_auto_run = false;
@@ -55,31 +89,89 @@ uint8_t g_state = STATE_UNINITIALIZED;
 /* EEPROM Saved settings */
 uint8_t g_horn_tenths= DEFAULT_HORN_TENTHS; // save in EEPROM, 255 means never set
 uint8_t g_brightness = DEFAULT_BRIGHTNESS; // 1-5
-bool g_horn_is_on = false;
+volatile bool g_horn_is_on = false;
+
+volatile uint8_t g_events = 0; // EVENT_* raised by the ISRs, taken by loop()
+volatile uint32_t g_event_micros = 0; // when the first pending event was raised
+volatile uint8_t g_event_tick_millis = EVENT_TICK_MILLIS;
+volatile uint8_t g_event_tick_countdown = EVENT_TICK_MILLIS;
+volatile uint8_t g_ticks = 0; // Timer1 ticks, wrapping
+int8_t g_idle_sleep = 1;
+struct sleep_stats g_sleep_stats[2];
+uint32_t g_awake_micros = 0; // when this loop() pass started
+struct loop_stats g_loop_stats;
+int16_t g_loop_budget_micros = DEFAULT_LOOP_BUDGET_MICROS;
+
+uint32_t g_loop_millis = 0; // "now" for this pass of loop()
+
+struct soft_timer g_timers[TIMER_COUNT];
+uint16_t g_timers_armed = 0; // bit per TIMER_*
+uint32_t g_next_timer_due_millis = 0; // valid while any timer is armed
+
+#if LOOP_TIMING
+struct timing_span g_timing[TIMING_SPAN_COUNT]; // the window being filled
+struct timing_span g_timing_last[TIMING_SPAN_COUNT]; // the last full window
+uint32_t g_timing_window_start_micros = 0;
+uint32_t g_timing_last_window_micros = 0;
+#endif
 
-int32_t g_horn_timer_millis = 0; // how much time the horn has left.
+/*
+  The horn is timed by the same 1 kHz tick as the countdown.  horn() or the countdown
+  ISR turns the relay on and loads the tick count; the ISR turns it off on the tick the
+  count runs out, no matter what loop() is doing.
+*/
+volatile uint16_t g_horn_ticks = 0; // 1 ms ticks until the horn turns off
+volatile uint32_t g_horn_on_micros = 0;
+volatile uint32_t g_horn_duration_micros = 0; // measured length of the last horn
+volatile uint16_t g_horn_scheduled_millis = 0;
 uint32_t g_uptime_seconds = 0;
-uint32_t g_last_uptime_millis = 0;
+
+uint32_t g_frame_count = 0;
+uint32_t g_frame_skew_micros = 0; // front commit finished this long after the rear
+uint32_t g_frame_skew_max_micros = 0;
+uint32_t g_frame_missed_ticks = 0; // Timer1 ticks replayed after front show()s
+uint32_t g_rear_commit_count = 0;
+uint16_t g_rear_commit_micros = 0;
+uint16_t g_rear_commit_max_micros = 0;
+uint16_t g_rear_commit_overruns = 0; // commits over REAR_COMMIT_BUDGET_MICROS
 
 struct display_info g_front_display;
-char g_front_display_primary_buffer[FRONT_DISPLAY_BUFFER_SIZE];
-char g_front_display_transitory_buffer[FRONT_DISPLAY_BUFFER_SIZE];
+char g_front_display_output_buffer[FRONT_DISPLAY_BUFFER_SIZE];
+char g_front_display_layer_buffers[DISPLAY_LAYER_COUNT][FRONT_DISPLAY_BUFFER_SIZE];
 
 struct display_info g_rear_display;
-char g_rear_display_primary_buffer[REAR_DISPLAY_BUFFER_SIZE];
-char g_rear_display_transitory_buffer[REAR_DISPLAY_BUFFER_SIZE];
-
-Adafruit_NeoPixel g_right_digit(LED_COUNT, PIN_RIGHT_LED_STRING, NEO_RGB + NEO_KHZ800);
-Adafruit_NeoPixel g_left_digit(LED_COUNT, PIN_LEFT_LED_STRING, NEO_RGB + NEO_KHZ800);
-TM1637Display g_tm1637_display(PIN_TM1637_CLK, PIN_TM1637_DIO);
-
-volatile uint8_t g_inputs_volatile = 0;
+char g_rear_display_output_buffer[REAR_DISPLAY_BUFFER_SIZE];
+char g_rear_display_layer_buffers[DISPLAY_LAYER_COUNT][REAR_DISPLAY_BUFFER_SIZE];
+
+// front digits, left to right, one LED string each
+const uint8_t g_front_digit_pins[] = FRONT_DIGIT_PINS;
+static_assert(sizeof(g_front_digit_pins) == FRONT_DIGIT_COUNT, "need one pin per front digit");
+Adafruit_NeoPixel g_front_digits[FRONT_DIGIT_COUNT];
+uint8_t g_rear_segments[REAR_DISPLAY_BUFFER_SIZE]; // staged for the next frame commit
+uint8_t g_rear_committed_segments[REAR_DISPLAY_BUFFER_SIZE]; // what the TM1637 is showing
+int8_t g_rear_hundredths = 1; // show hundredths on the rear under 10 seconds
+TM1637Display g_tm1637_display(PIN_TM1637_CLK, PIN_TM1637_DIO, TM1637_BIT_DELAY_MICROS);
+
+volatile uint8_t g_inputs_volatile = 0; // levels as the ISRs last saw them
+struct input_event g_input_queue[INPUT_QUEUE_LENGTH];
+volatile uint8_t g_input_queue_head = 0; // written only by the ISRs
+volatile uint8_t g_input_queue_tail = 0; // written only by loop()
+volatile bool g_input_queue_overflowed = false;
+struct debouncer g_debouncer; // only touched by the timer ISR, once set up
+volatile bool g_debounce_awake = true;
+struct debounce_stamps g_debounce_stamps; // first edge of each input's burst; ISRs only
+uint8_t g_debounce_countdown = 1; // ticks to the next sample
+int8_t g_debounce_millis = DEFAULT_DEBOUNCE_SAMPLE_MILLIS; // sample interval
+volatile uint16_t g_raw_input_edges = 0; // pin changes, bounces and all
+uint16_t g_input_queue_overflows = 0;
+struct input_event g_input_history[INPUT_HISTORY_LENGTH]; // most recent last
 uint8_t g_inputs = 0;
-uint8_t g_last_inputs = 0;
 uint8_t g_button_pressed_events = 0;
 uint8_t g_button_released_events = 0;
+uint32_t g_start_stop_pressed_micros = 0; // edge time of the last start/stop press
+uint32_t g_start_stop_reaction_micros = 0; // that edge to the clock starting or stopping
 
-uint32_t g_state_timeout_millis = 0; // used in any state where we want a timeout to leave it.
+bool g_state_timeout_expired = false; // set by TIMER_STATE, in any state where we want a timeout to leave it.
 
 // Current color setting.  Put in a union so it is easy to use with
 // some of the Adafruit_NeoPixel color conversion utilities.
@@ -92,9 +184,61 @@ uint8_t g_radio_channel = MIN_RADIO_CHANNEL;
 bool g_radio_ok = false;
 uint8_t g_radio_mode = RADIO_MODE_OFF;
 uint8_t g_radio_signal_strength = 0;
+int8_t g_radio_multicast = 0; // save in EEPROM
+int8_t g_radio_listener_id = 0; // save in EEPROM; 0 answers no polls
+int8_t g_radio_poll_listeners = 0; // save in EEPROM; how many listener ids a broadcaster polls
 
 struct radio_message g_radio_message;
+uint8_t g_radio_packet[RADIO_PACKET_SIZE]; // g_radio_message as it goes over the air
+struct radio_ack g_radio_ack;
+
+/* broadcaster side of the time sync */
+uint16_t g_sync_sent_serial = 0; // last packet delivered, and its t1 and round trip
+uint32_t g_sync_sent_micros = 0;
+uint32_t g_sync_sent_rtt_micros = 0;
+uint32_t g_sync_rtt_micros = 0; // last round trip
+uint32_t g_sync_min_rtt_micros = 0xffffffff;
+uint32_t g_sync_delay_micros = 0; // last one-way delay estimate
+int32_t g_sync_offset_micros = SYNC_OFFSET_UNKNOWN;
+int32_t g_sync_last_transit_micros = 0;
+uint32_t g_sync_jitter_micros = 0;
+uint16_t g_sync_samples = 0;
+
+/* listener side */
+uint32_t g_sync_age_micros = 0; // how old the last clock_millis was when it was read
+uint32_t g_sync_age_jitter_micros = 0;
 uint16_t g_message_serial_number = 0;
+struct radio_sequence g_radio_rx_sequence = { 0 }; // for dropping copies and counting gaps
+struct radio_rx_stats g_radio_rx_stats;
+struct listener_health g_listener_health[RADIO_MAX_LISTENERS];
+struct listener_status g_listener_status[RADIO_MAX_LISTENERS + 1]; // by listener id, 0 for none
+struct link_stats g_link_stats;
+uint8_t g_radio_switch_channel = 0; // where a SWITCH_CHANNEL in the air is going
+uint8_t g_radio_switch_attempts = 0;
+
+/* channel scan */
+uint8_t g_scan_state = RADIO_SCAN_IDLE;
+uint8_t g_scan_channel = 0;
+uint8_t g_scan_sample = 0;
+uint32_t g_scan_listen_micros = 0;
+uint8_t g_scan_hits[MAX_RADIO_CHANNEL + 1]; // readings with something on the air
+bool g_scan_done = false;
+
+/* transmit state machine */
+uint8_t g_radio_tx_pending = 0; // RADIO_COMMAND_BIT()s for the next packet
+uint8_t g_radio_tx_state = RADIO_TX_IDLE;
+uint8_t g_radio_tx_commands = 0; // the ones in the air
+uint8_t g_radio_tx_target = 0; // 0 for everyone, or the listener id being polled
+uint8_t g_radio_poll_due = 0; // listener id to poll when the transceiver is free
+uint8_t g_radio_tx_attempts = 0;
+bool g_radio_tx_ok = false;
+uint32_t g_radio_tx_start_micros = 0;
+uint32_t g_radio_tx_done_micros = 0;
+uint32_t g_radio_tx_deadline_millis = 0;
+uint32_t g_radio_tx_last_millis = 0; // last packet to everyone, for heartbeats
+struct radio_tx_stats g_radio_tx_stats;
+struct radio_power g_radio_power;
+
 /* 
   We lookup the segments in this table by scanning it.  Makes it easy to add more.
   No slower than a case statement.
@@ -161,54 +305,447 @@ const uint8_t char_to_segment_table[][2] =
    {0,   0b01010011}  // sort of a question mark looking thing
   };
 
+void raise_event_from_isr(uint8_t event) {
+  if(g_events == 0)
+    g_event_micros = micros();
+  g_events |= event;
+}
+
+void queue_input_from_isr(uint8_t changed, uint8_t level, uint32_t edge_micros) {
+  g_inputs_volatile = level;
+
+  uint8_t next_head = (g_input_queue_head + 1) & (INPUT_QUEUE_LENGTH - 1);
+  if(next_head == g_input_queue_tail) {
+    // full: loop() will resynchronize from g_inputs_volatile
+    g_input_queue_overflowed = true;
+  } else {
+    struct input_event *e = &g_input_queue[g_input_queue_head];
+    e->micros = edge_micros;
+    e->changed = changed;
+    e->level = level;
+    g_input_queue_head = next_head;
+  }
+  raise_event_from_isr(EVENT_INPUT);
+}
+
 /* 
-    If we change an input pin purpose in shot-clock.h, we also have to change the input mapping here
-    in the ISRs.
+    If we change an input pin purpose in shot-clock.h, we also have to change the input mapping here.
 */
+uint8_t read_raw_inputs() {
+  uint8_t pinb = PINB;
+  uint8_t pinc = PINC;
+  uint8_t pind = PIND;
+  return ((pinb & bit(PINB1)) ? INPUT_SETTINGS_BUTTON : 0) |
+    ((pinc & bit(PINC0)) ? INPUT_DOWN_BUTTON : 0) |
+    ((pind & bit(PIND3)) ? INPUT_UP_BUTTON : 0) |
+    ((pind & bit(PIND4)) ? INPUT_START_STOP_BUTTON : 0) |
+    ((pind & bit(PIND5)) ? INPUT_RESET_30_BUTTON : 0) |
+    ((pind & bit(PIND6)) ? INPUT_RESET_20_BUTTON : 0);
+}
+
+void wake_debouncer_from_isr() {
+  // Pin changes only wake the sampler; bounces are sorted out on the timer.
+  if(g_raw_input_edges < 0xffff)
+    g_raw_input_edges++;
+  debounce_edge(&g_debouncer, &g_debounce_stamps, read_raw_inputs(), micros());
+  if(!g_debounce_awake) {
+    g_debounce_awake = true;
+    g_debounce_countdown = 1; // sample on the next tick
+  }
+}
+
+void sample_inputs_from_isr() {
+  uint8_t raw = read_raw_inputs();
+  uint8_t toggled = debounce_sample(&g_debouncer, raw);
+  uint32_t edge_micros = debounce_stamp_sample(&g_debouncer, &g_debounce_stamps, raw, toggled, micros());
+  if(toggled) {
+    // stamped with the first edge of its own burst, so reaction times include the debounce
+    queue_input_from_isr(toggled, g_debouncer.level, edge_micros);
+  }
+  if(!debounce_pending(&g_debouncer, raw)) {
+    g_debounce_awake = false; // everything agrees; the counters are back at idle
+  }
+}
 
 ISR (PCINT0_vect) {
   // one of pins D8 to D13 has changed
-  if(PINB & bit(PINB1)) {
-    g_inputs_volatile |= INPUT_SETTINGS_BUTTON;
-  } else {
-    g_inputs_volatile &= ~INPUT_SETTINGS_BUTTON;
-  }
+  wake_debouncer_from_isr();
 }
 
 ISR (PCINT1_vect) {
   // one of pins A0 to A5 or RST has changed
-  if(PINC & bit(PINC0)) {
-    g_inputs_volatile |= INPUT_DOWN_BUTTON;
-  } else {
-    g_inputs_volatile &= ~INPUT_DOWN_BUTTON;
-  }
+  wake_debouncer_from_isr();
 }
 
 ISR (PCINT2_vect) {
   // one of pins D0 to D7 has changed
-  if(PIND & bit(PIND3)) {
-    g_inputs_volatile |= INPUT_UP_BUTTON;
-  } else {
-    g_inputs_volatile &= ~INPUT_UP_BUTTON;
+  wake_debouncer_from_isr();
+}
+
+void record_input_history(struct input_event *e) {
+  memmove(g_input_history, g_input_history + 1, sizeof(g_input_history) - sizeof(g_input_history[0]));
+  g_input_history[INPUT_HISTORY_LENGTH - 1] = *e;
+}
+
+void drain_input_queue() {
+  /*
+    Turn every edge since the last pass into press and release events.  A button pressed
+    and released since then gets both; g_inputs ends up at the latest level.
+  */
+  uint8_t tail = g_input_queue_tail;
+  while(tail != g_input_queue_head) {
+    struct input_event *e = &g_input_queue[tail];
+    uint8_t pressed = e->changed & e->level;
+    g_button_pressed_events |= pressed;
+    g_button_released_events |= e->changed & ~e->level;
+    if(pressed & INPUT_START_STOP_BUTTON)
+      g_start_stop_pressed_micros = e->micros;
+    g_inputs = e->level;
+    record_input_history(e);
+    tail = (tail + 1) & (INPUT_QUEUE_LENGTH - 1);
+    g_input_queue_tail = tail;
+  }
+
+  if(g_input_queue_overflowed) {
+    // edges were lost; fall back to comparing levels, like sampling once a pass did
+    g_input_queue_overflowed = false;
+    g_input_queue_overflows++;
+    uint8_t level = g_inputs_volatile;
+    uint8_t transitions = level ^ g_inputs;
+    g_button_pressed_events |= level & transitions;
+    g_button_released_events |= ~level & transitions;
+    if(level & transitions & INPUT_START_STOP_BUTTON)
+      g_start_stop_pressed_micros = micros();
+    g_inputs = level;
+  }
+}
+
+void horn_on_from_isr(uint16_t millis) {
+  // interrupts are off: we are either in the ISR or in an ATOMIC_BLOCK
+  g_horn_ticks = millis;
+  g_horn_scheduled_millis = millis;
+  g_horn_on_micros = micros();
+  g_horn_is_on = true;
+  digitalWrite(PIN_HORN_RELAY, HIGH);
+}
+
+void countdown_tick() {
+  // every millisecond, from the Timer1 ISR
+  g_ticks++;
+  if(g_horn_ticks > 0 && --g_horn_ticks == 0) {
+    digitalWrite(PIN_HORN_RELAY, LOW);
+    g_horn_is_on = false;
+    g_horn_duration_micros = micros() - g_horn_on_micros;
+    raise_event_from_isr(EVENT_HORN);
+  }
+
+  if(g_debounce_awake && --g_debounce_countdown == 0) {
+    g_debounce_countdown = g_debounce_millis > 0 ? g_debounce_millis : 1;
+    sample_inputs_from_isr();
+  }
+
+  if(--g_event_tick_countdown == 0) {
+    g_event_tick_countdown = g_event_tick_millis;
+    raise_event_from_isr(EVENT_TICK);
+  }
+
+  if(countdown_step(&g_countdown, g_tick_q24)) {
+    g_countdown_zero_micros = micros();
+    if(g_horn_tenths > 0) {
+      horn_on_from_isr(g_horn_tenths * 100);
+    }
+    raise_event_from_isr(EVENT_COUNTDOWN);
   }
+}
 
-  if(PIND & bit(PIND4)) {
-    g_inputs_volatile |= INPUT_START_STOP_BUTTON;
-  } else {
-    g_inputs_volatile &= ~INPUT_START_STOP_BUTTON;
+ISR (TIMER1_COMPA_vect) {
+  countdown_tick();
+}
+
+void snapshot_loop_time() {
+  g_loop_millis = time_source_millis();
+}
+
+void horn(uint16_t tenths) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if(tenths > 0) {
+      horn_on_from_isr(tenths * 100);
+    } else {
+      // "0 horn" silences it
+      g_horn_ticks = 0;
+      g_horn_is_on = false;
+      digitalWrite(PIN_HORN_RELAY, LOW);
+    }
   }
+}
 
-  if(PIND & bit(PIND5)) {
-    g_inputs_volatile |= INPUT_RESET_30_BUTTON;
+uint8_t wait_for_event() {
+  /*
+    Idle until an ISR raises an event or serial input arrives, and return the events.  In
+    SLEEP_MODE_IDLE the timers, USART and pin changes keep running and any of their
+    interrupts wakes the CPU; if it wasn't for us, we go straight back to sleep.
+  */
+  uint8_t events;
+  struct sleep_stats *stats = &g_sleep_stats[g_clock_is_running ? SLEEP_STATS_RUNNING : SLEEP_STATS_STOPPED];
+  uint32_t sleep_micros = micros();
+  stats->awake_micros += sleep_micros - g_awake_micros;
+
+  // only a stopped clock with nothing moving, no radio to listen to and no timer due
+  // soon can tick slowly
+  uint32_t due_millis;
+  bool timer_due_soon = next_timer_due(&due_millis) &&
+    (int32_t)(due_millis - time_source_millis()) < IDLE_EVENT_TICK_MILLIS;
+  if(g_radio_mode == RADIO_MODE_LISTEN && g_remote_clock.running) {
+    // how long a packet sits unread is error in the listener's clock
+    g_event_tick_millis = LISTEN_EVENT_TICK_MILLIS;
   } else {
-    g_inputs_volatile &= ~INPUT_RESET_30_BUTTON;
+    g_event_tick_millis = (g_state != STATE_STOPPED || g_front_display.animated || g_rear_display.animated ||
+			   g_horn_is_on || g_radio_mode == RADIO_MODE_LISTEN || timer_due_soon ||
+			   g_scan_state != RADIO_SCAN_IDLE)
+      ? EVENT_TICK_MILLIS : IDLE_EVENT_TICK_MILLIS;
+  }
+
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  uint8_t polled_tick = g_ticks - 1;
+  while(true) {
+    cli();
+    if(g_events || Serial.available() || !g_idle_sleep) {
+      break;
+    }
+    if(g_radio_tx_state == RADIO_TX_SENDING && g_ticks != polled_tick) {
+      // the transceiver has no interrupt line, so while a packet is in the air read its
+      // status once a tick, and sleep in between rather than spin on the SPI bus
+      polled_tick = g_ticks;
+      sei();
+      if(poll_radio_transmit()) {
+	cli();
+	break;
+      }
+      continue;
+    }
+    sleep_enable();
+    sei(); // takes effect after the next instruction, so no event can slip in before the sleep
+    sleep_cpu();
+    sleep_disable();
+  }
+  events = g_events;
+  uint32_t event_micros = g_event_micros;
+  g_events = 0;
+  sei();
+
+  g_awake_micros = micros();
+  stats->asleep_micros += g_awake_micros - sleep_micros;
+  if(events) {
+    stats->wakeups++;
+    uint32_t latency = g_awake_micros - event_micros;
+    stats->latency_micros = latency > 0xffff ? 0xffff : latency;
+    if(stats->latency_micros > stats->latency_max_micros)
+      stats->latency_max_micros = stats->latency_micros;
+  }
+  return events;
+}
+
+void reset_sleep_stats() {
+  memset(g_sleep_stats, 0, sizeof(g_sleep_stats));
+}
+
+void record_loop_time(uint8_t state) {
+  uint32_t pass_micros = micros() - g_awake_micros;
+
+  uint8_t bucket = 0;
+  for(uint32_t m = pass_micros >> 1; m != 0 && bucket < LOOP_HISTOGRAM_BUCKETS - 1; m >>= 1) {
+    bucket++;
+  }
+  if(g_loop_stats.histogram[bucket] < 0xffff)
+    g_loop_stats.histogram[bucket]++;
+
+  g_loop_stats.passes++;
+  if(pass_micros > g_loop_stats.max_micros) {
+    g_loop_stats.max_micros = pass_micros;
+    g_loop_stats.max_state = state;
+  }
+  if(g_loop_budget_micros > 0 && pass_micros > (uint32_t)g_loop_budget_micros)
+    g_loop_stats.deadline_misses++;
+}
+
+void reset_loop_stats() {
+  memset(&g_loop_stats, 0, sizeof(g_loop_stats));
+}
+
+#if LOOP_TIMING
+void add_timing(uint8_t span, uint32_t micros) {
+  struct timing_span *t = &g_timing[span];
+  t->micros += micros;
+  if(t->count < 0xffff)
+    t->count++;
+  if(micros > t->max_micros)
+    t->max_micros = micros > 0xffff ? 0xffff : micros;
+}
+
+void update_timing_window() {
+  // TIMER_TIMING_WINDOW
+  uint32_t now_micros = micros();
+  uint32_t window_micros = now_micros - g_timing_window_start_micros;
+  memcpy(g_timing_last, g_timing, sizeof(g_timing));
+  memset(g_timing, 0, sizeof(g_timing));
+  g_timing_last_window_micros = window_micros;
+  g_timing_window_start_micros = now_micros;
+}
+#endif
+
+/* in TIMER_* order */
+void (*const g_timer_callbacks[TIMER_COUNT])(void) =
+  {
+   state_timeout,
+   update_uptime,
+   front_refresh_timer,
+   rear_refresh_timer,
+   front_expiry_timer,
+   rear_expiry_timer,
+   rainbow_timer,
+   update_temperature_compensation,
+#if LOOP_TIMING
+   update_timing_window,
+#else
+   NULL,
+#endif
+   radio_poll_timer,
+   radio_heartbeat_timer,
+   link_loss_timer,
+  };
+
+void find_next_timer_due() {
+  bool found = false;
+  for(uint8_t i = 0; i < TIMER_COUNT; i++) {
+    if(!(g_timers_armed & bit(i)))
+      continue;
+    if(!found || (int32_t)(g_timers[i].due_millis - g_next_timer_due_millis) < 0) {
+      g_next_timer_due_millis = g_timers[i].due_millis;
+      found = true;
+    }
+  }
+}
+
+void start_timer(uint8_t timer, uint32_t delay_millis, uint32_t period_millis) {
+  // restarts the timer if it is already armed
+  g_timers[timer].due_millis = g_loop_millis + delay_millis;
+  g_timers[timer].period_millis = period_millis;
+  g_timers_armed |= bit(timer);
+  find_next_timer_due();
+}
+
+void stop_timer(uint8_t timer) {
+  if(g_timers_armed & bit(timer)) {
+    g_timers_armed &= ~bit(timer);
+    find_next_timer_due();
+  }
+}
+
+bool is_timer_armed(uint8_t timer) {
+  return (g_timers_armed & bit(timer)) != 0;
+}
+
+bool next_timer_due(uint32_t *due_millis) {
+  if(g_timers_armed == 0)
+    return false;
+  *due_millis = g_next_timer_due_millis;
+  return true;
+}
+
+void run_timers(uint32_t current_millis) {
+  // the only per-pass cost while nothing is due
+  if(g_timers_armed == 0 || (int32_t)(current_millis - g_next_timer_due_millis) < 0)
+    return;
+
+  for(uint8_t i = 0; i < TIMER_COUNT; i++) {
+    struct soft_timer *t = &g_timers[i];
+    if(!(g_timers_armed & bit(i)) || (int32_t)(current_millis - t->due_millis) < 0)
+      continue;
+    // rearm or disarm before the callback, so it can restart or stop its own timer
+    if(t->period_millis) {
+      t->due_millis += t->period_millis;
+      if((int32_t)(current_millis - t->due_millis) >= 0)
+	t->due_millis = current_millis + t->period_millis; // fell behind; don't fire in a burst
+    } else {
+      g_timers_armed &= ~bit(i);
+    }
+    g_timer_callbacks[i]();
+  }
+  find_next_timer_due();
+}
+
+void update_clock_tick(int8_t celsius) {
+  // The tick is 1/(1 + ppm/10^6) ms, which is 1 - ppm/10^6 to well under a ppm for any
+  // resonator we would use.  2^24/10^6 is 16.777, close enough as 16777/1000.
+  int32_t ppm = g_clock_ppm;
+  if(g_clock_tempco != 0 && celsius != TEMP_NOT_READ) {
+    ppm += (int32_t)g_clock_tempco * (celsius - g_clock_cal_celsius);
   }
+  uint32_t tick_q24 = TICK_Q24_NOMINAL - (ppm * 16777L) / 1000;
 
-  if(PIND & bit(PIND6)) {
-    g_inputs_volatile |= INPUT_RESET_20_BUTTON;
+  g_clock_celsius = celsius;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    g_tick_q24 = tick_q24;
+  }
+}
+
+void start_clock_calibration() {
+  g_calibration_samples = 0;
+}
+
+void add_clock_calibration_reference(int32_t reference_millis) {
+  // References are milliseconds from the reference clock, in any epoch.  They must come
+  // less than 71 minutes apart so micros() can't wrap between them.
+  uint32_t now = micros();
+  if(g_calibration_samples == 0) {
+    g_calibration_first_reference = reference_millis;
+    g_calibration_local_millis = 0;
+    g_calibration_local_micros = 0;
   } else {
-    g_inputs_volatile &= ~INPUT_RESET_20_BUTTON;
+    uint32_t local_micros = g_calibration_local_micros + (now - g_calibration_last_micros);
+    g_calibration_local_millis += local_micros / 1000;
+    g_calibration_local_micros = local_micros % 1000;
   }
+  g_calibration_last_reference = reference_millis;
+  g_calibration_last_micros = now;
+  if(g_calibration_samples < 255)
+    g_calibration_samples++;
+}
+
+bool clock_calibration_ppm(int16_t *ppm) {
+  // how many ppm faster our clock ran than the reference
+  int32_t reference_millis = g_calibration_last_reference - g_calibration_first_reference;
+  if(g_calibration_samples < 2 || reference_millis <= 0)
+    return false;
+
+  float estimate = ((float)g_calibration_local_millis - reference_millis) * 1000000.0 / reference_millis;
+  if(estimate > MAX_CLOCK_PPM || estimate < -MAX_CLOCK_PPM)
+    return false;
+
+  *ppm = round(estimate);
+  return true;
+}
+
+void update_temperature_compensation() {
+  // TIMER_TEMP_COMPENSATION.  Only worth an I2C read if there is a temperature
+  // coefficient, or a broadcaster to report it to, and the resonator drifts with the
+  // room: keep up while nothing is timing.
+  if((g_clock_tempco == 0 && g_radio_mode != RADIO_MODE_LISTEN) || g_state != STATE_STOPPED)
+    return;
+  int8_t celsius = read_temperature_celsius();
+  if(celsius != TEMP_NOT_READ)
+    update_clock_tick(celsius);
+}
+
+void setup_countdown_timer() {
+  cli();
+  // CTC mode, prescaler 64: 16 MHz / 64 / 250 = 1 kHz
+  TCCR1A = 0;
+  TCCR1B = bit(WGM12) | bit(CS11) | bit(CS10);
+  TCNT1 = 0;
+  OCR1A = (F_CPU / 64 / 1000) - 1;
+  TIMSK1 |= bit(OCIE1A);
+  sei();
 }
 
 void setup_watchdog() {
@@ -255,13 +792,13 @@ void setup_watchdog() {
   sei();
 }
 
-// uint8_t saved_MCUSR = MCUSR;
 void radio_broadcast() {
   g_radio.stopListening();                // put radio in TX mode
 }
 
 void radio_listen() {
   g_radio.startListening();
+  g_radio.flush_tx(); // no stale ACK payloads from before
 }
 
 void radio_off() {
@@ -271,10 +808,14 @@ void radio_off() {
 void setup_radio() {
   g_radio_ok = g_radio.begin();
   if(g_radio_ok) {
-    g_radio.setPALevel(RF24_PA_MAX);
+    g_radio.setPALevel(RF24_PA_MAX); // until update_radio() knows the mode and channel
     g_radio.setDataRate( RF24_250KBPS ); // = 31250 chars/second = .032 ms per char. 100 chars in 3.2ms.
     // Reliability seems to be drastically affected if the Arduino serial cable is plugged in.
     g_radio.setRetries(RADIO_DELAY, RADIO_RETRIES); // delay, count
+    // ACK payloads carry the listener's times back for the time sync
+    g_radio.enableDynamicPayloads();
+    g_radio.enableAckPayload();
+    g_radio.enableDynamicAck(); // multicast packets go without one
 
     byte address[5] = RADIO_ADDRESS;
     g_radio.openWritingPipe(address);
@@ -288,10 +829,15 @@ void setup_radio() {
 
 void setup() {
 
+  // why we reset goes to the broadcaster with the listener's status
+  g_reset_cause = MCUSR;
+  MCUSR = 0;
+  snapshot_loop_time();
   Wire.begin();
 
-  pinMode(PIN_RIGHT_LED_STRING, OUTPUT);
-  pinMode(PIN_LEFT_LED_STRING, OUTPUT);
+  for(int i = 0; i < FRONT_DIGIT_COUNT; i++) {
+    pinMode(g_front_digit_pins[i], OUTPUT);
+  }
 
   pinMode(PIN_START_STOP_BUTTON, INPUT);
   pinMode(PIN_RESET_30_BUTTON, INPUT);
@@ -345,18 +891,24 @@ void setup() {
   PCMSK2 |= bit (PCINT22);  // RESET_20_BUTTON, PD6, D6
 
   // Enable the port change interrupts for all ports
+  // start the debouncer from the buttons as they are, so one held at power on is no press
+  debounce_reset(&g_debouncer, read_raw_inputs());
+  debounce_stamps_reset(&g_debounce_stamps, g_debouncer.level);
+  g_inputs_volatile = g_inputs = g_debouncer.level;
   PCICR |= bit(PCIE2) | bit(PCIE1) | bit(PCIE0);
 
   Serial.begin(115200);
   Serial.println();
   Serial.println(F("*** Shot clock initializing. ***"));
 
-  g_right_digit.begin();
-  g_left_digit.begin();
-  g_right_digit.clear();
-  g_right_digit.show();
-  g_left_digit.clear();
-  g_left_digit.show();
+  for(int i = 0; i < FRONT_DIGIT_COUNT; i++) {
+    g_front_digits[i].updateType(NEO_RGB + NEO_KHZ800);
+    g_front_digits[i].updateLength(front_digit::led_count);
+    g_front_digits[i].setPin(g_front_digit_pins[i]);
+    g_front_digits[i].begin();
+    g_front_digits[i].clear();
+    g_front_digits[i].show();
+  }
   delay(125);
     
   init_displays();
@@ -365,46 +917,70 @@ void setup() {
 
   load_settings();
 
+  setup_countdown_timer();
+
   // POST may have delays in it, which would make the watchdog upset, so we do this last
   setup_watchdog();
 
+  snapshot_loop_time(); // POST takes a while
+  start_timer(TIMER_UPTIME, 1000, 1000);
+  start_timer(TIMER_TEMP_COMPENSATION, TEMP_COMPENSATION_INTERVAL_MILLIS, TEMP_COMPENSATION_INTERVAL_MILLIS);
+#if LOOP_TIMING
+  start_timer(TIMER_TIMING_WINDOW, TIMING_WINDOW_MILLIS, TIMING_WINDOW_MILLIS);
+#endif
+  start_timer(TIMER_RADIO_POLL, RADIO_POLL_INTERVAL_MILLIS, RADIO_POLL_INTERVAL_MILLIS);
+  start_timer(TIMER_RADIO_HEARTBEAT, RADIO_HEARTBEAT_CHECK_MILLIS, RADIO_HEARTBEAT_CHECK_MILLIS);
+
   state_init();
+
+  g_awake_micros = micros();
 }
 
 void clear_display(struct display_info *display) {
-  memset(display->primary_buffer, ' ', display->buffer_size);
-  memset(display->transitory_buffer, ' ', display->buffer_size);
+  memset(display->output_buffer, ' ', display->buffer_size);
+  for(int i = 0; i < DISPLAY_LAYER_COUNT; i++) {
+    memset(display->layers[i].buffer, ' ', display->buffer_size);
+    display->layers[i].active = 0;
+    display->layers[i].expires = 0;
+  }
+  display->layers[LAYER_PRIMARY].active = 1;
+  display->layers_changed = 0;
+  stop_timer(display->expiry_timer);
 }
 
 void init_displays() {
   g_front_display.buffer_size = FRONT_DISPLAY_BUFFER_SIZE;
-  g_front_display.primary_buffer = g_front_display_primary_buffer;
-  g_front_display.transitory_buffer = g_front_display_transitory_buffer;
-  g_front_display.use_primary_buffer = 1;
+  g_front_display.output_buffer = g_front_display_output_buffer;
+  for(int i = 0; i < DISPLAY_LAYER_COUNT; i++) {
+    g_front_display.layers[i].buffer = g_front_display_layer_buffers[i];
+  }
   g_front_display.animated = 0;
-  g_front_display.transitory_timer_millis = 0;
-  g_front_display.refresh_millis = 0;
   g_front_display.requires_refresh = 1;
+  g_front_display.refresh_timer = TIMER_FRONT_REFRESH;
+  g_front_display.expiry_timer = TIMER_FRONT_EXPIRY;
   clear_display(&g_front_display);
+  start_timer(TIMER_FRONT_REFRESH, 0, 0);
 
   g_rear_display.buffer_size = REAR_DISPLAY_BUFFER_SIZE;
-  g_rear_display.primary_buffer = g_rear_display_primary_buffer;
-  g_rear_display.transitory_buffer = g_rear_display_transitory_buffer;
-  g_rear_display.use_primary_buffer = 1;
-  g_front_display.animated = 0;
-  g_rear_display.refresh_millis = 0;
-  g_rear_display.requires_refresh = 0;
+  g_rear_display.output_buffer = g_rear_display_output_buffer;
+  for(int i = 0; i < DISPLAY_LAYER_COUNT; i++) {
+    g_rear_display.layers[i].buffer = g_rear_display_layer_buffers[i];
+  }
+  g_rear_display.animated = 0;
+  g_rear_display.requires_refresh = 0; // so TIMER_REAR_REFRESH is never started
+  g_rear_display.refresh_timer = TIMER_REAR_REFRESH;
+  g_rear_display.expiry_timer = TIMER_REAR_EXPIRY;
   clear_display(&g_rear_display);
 
   g_color_mode = COLOR_MODE_WHITE;
 
   g_tm1637_display.setBrightness(0x0f);
   g_tm1637_display.clear();
+  memset(g_rear_committed_segments, 0, REAR_DISPLAY_BUFFER_SIZE);
 
   displays_dirty();
 
-  update_display(&g_front_display);
-  update_display(&g_rear_display);
+  update_displays();
 }
 
 void displays_dirty() {
@@ -440,10 +1016,11 @@ void update_radio() {
   Serial.print(2000L + g_radio.getChannel());
   Serial.println(F(" MHz"));
 
-  g_remote_clock_is_running = false;
+  g_remote_clock.running = false;
 
   static uint8_t s_old_radio_mode = RADIO_MODE_OFF;
   if(s_old_radio_mode != g_radio_mode) {
+    reset_radio_transmit();
     switch(g_radio_mode) {
     case RADIO_MODE_OFF:
       radio_off(); // puts the radio into TX mode, so it doesn't listen, but we don't send anything
@@ -459,6 +1036,35 @@ void update_radio() {
     Serial.print(F("Updated radio mode to "));
     Serial.println(g_radio_mode);
   }
+
+  // a listener with an id answers polls on its own address as well; only a new id
+  // reopens the pipe, since the flush would throw away the ACK payload waiting there
+  static uint8_t s_poll_id = 0;
+  uint8_t poll_id = g_radio_mode == RADIO_MODE_LISTEN ? g_radio_listener_id : 0;
+  if(poll_id != s_poll_id) {
+    if(poll_id > 0) {
+      byte address[5] = RADIO_ADDRESS;
+      address[0] = RADIO_POLL_ADDRESS_BYTE(poll_id);
+      g_radio.openReadingPipe(RADIO_POLL_PIPE, address);
+      // the first poll's ACK needs a payload waiting
+      g_radio.flush_tx();
+      load_radio_ack(RADIO_POLL_PIPE, 0, 0, 0);
+    } else {
+      g_radio.closeReadingPipe(RADIO_POLL_PIPE);
+    }
+    s_poll_id = poll_id;
+  }
+  g_radio_rx_sequence.started = false;
+
+  update_radio_power();
+
+  // whatever the link was doing before, a listener starts watching it afresh
+  clear_link_lost();
+  if(g_radio_mode == RADIO_MODE_LISTEN) {
+    start_link_loss_timer();
+  } else {
+    stop_timer(TIMER_LINK_LOSS);
+  }
 }
 
 void load_settings() {
@@ -466,14 +1072,35 @@ void load_settings() {
   g_horn_tenths = EEPROM.read(EEPROM_HORN_TENTHS);
   g_radio_mode = EEPROM.read(EEPROM_RADIO_MODE);
   g_radio_channel = EEPROM.read(EEPROM_RADIO_CHANNEL);
+  g_clock_ppm = EEPROM.read(EEPROM_CLOCK_PPM_LOW) | (EEPROM.read(EEPROM_CLOCK_PPM_HIGH) << 8);
+  g_clock_cal_celsius = EEPROM.read(EEPROM_CLOCK_CAL_CELSIUS);
+  g_clock_tempco = EEPROM.read(EEPROM_CLOCK_TEMPCO);
+  g_radio_multicast = EEPROM.read(EEPROM_RADIO_MULTICAST);
+  g_radio_listener_id = EEPROM.read(EEPROM_RADIO_LISTENER_ID);
+  g_radio_poll_listeners = EEPROM.read(EEPROM_RADIO_POLL_LISTENERS);
 
   // This handles default EEPROM values of 255
   if(g_brightness > MAX_BRIGHTNESS) g_brightness = DEFAULT_BRIGHTNESS;
   if(g_horn_tenths > MAX_HORN_TENTHS) g_horn_tenths = DEFAULT_HORN_TENTHS;
   if(g_radio_mode > MAX_RADIO_MODE) g_radio_mode = RADIO_MODE_BROADCAST;
   if(g_radio_channel > MAX_RADIO_CHANNEL) g_radio_channel = MIN_RADIO_CHANNEL;
+  // -1 is a fine ppm, calibration temperature or tempco, so only a clock that never
+  // saved them takes blank EEPROM's -1 as unset
+  if(EEPROM.read(EEPROM_CLOCK_CAL_SAVED) != CLOCK_CAL_SAVED) {
+    if(g_clock_ppm == -1) g_clock_ppm = 0;
+    if(g_clock_cal_celsius == -1) g_clock_cal_celsius = DEFAULT_CLOCK_CAL_CELSIUS;
+    if(g_clock_tempco == -1) g_clock_tempco = 0;
+  }
+  if(g_clock_ppm > MAX_CLOCK_PPM || g_clock_ppm < -MAX_CLOCK_PPM) g_clock_ppm = 0;
+  if(g_clock_cal_celsius == TEMP_NOT_READ) g_clock_cal_celsius = DEFAULT_CLOCK_CAL_CELSIUS;
+  if(g_clock_tempco > MAX_CLOCK_TEMPCO || g_clock_tempco < -MAX_CLOCK_TEMPCO) g_clock_tempco = 0;
+  if(g_radio_multicast != 1) g_radio_multicast = 0;
+  if(g_radio_listener_id < 0 || g_radio_listener_id > RADIO_MAX_LISTENERS) g_radio_listener_id = 0;
+  if(g_radio_poll_listeners < 0 || g_radio_poll_listeners > RADIO_MAX_LISTENERS) g_radio_poll_listeners = 0;
 
   update_radio();
+
+  update_clock_tick((g_clock_tempco != 0 || g_radio_mode == RADIO_MODE_LISTEN) ? read_temperature_celsius() : TEMP_NOT_READ);
   
   set_led_brightness();
 }
@@ -504,10 +1131,19 @@ bool save_setting_if_changed(uint8_t eeprom_address, uint8_t current_value) {
 bool save_settings() {
   bool changes = false;
   // g_debug = true;
-  changes = changes || save_setting_if_changed(EEPROM_BRIGHTNESS, g_brightness);
-  changes = changes || save_setting_if_changed(EEPROM_HORN_TENTHS, g_horn_tenths);
-  changes = changes || save_setting_if_changed(EEPROM_RADIO_MODE, g_radio_mode);
-  changes = changes || save_setting_if_changed(EEPROM_RADIO_CHANNEL, g_radio_channel);
+  // save first, so one change doesn't short-circuit saving the rest
+  changes = save_setting_if_changed(EEPROM_BRIGHTNESS, g_brightness) || changes;
+  changes = save_setting_if_changed(EEPROM_HORN_TENTHS, g_horn_tenths) || changes;
+  changes = save_setting_if_changed(EEPROM_RADIO_MODE, g_radio_mode) || changes;
+  changes = save_setting_if_changed(EEPROM_RADIO_CHANNEL, g_radio_channel) || changes;
+  changes = save_setting_if_changed(EEPROM_CLOCK_PPM_LOW, g_clock_ppm & 0xff) || changes;
+  changes = save_setting_if_changed(EEPROM_CLOCK_PPM_HIGH, (g_clock_ppm >> 8) & 0xff) || changes;
+  changes = save_setting_if_changed(EEPROM_CLOCK_CAL_CELSIUS, g_clock_cal_celsius) || changes;
+  changes = save_setting_if_changed(EEPROM_CLOCK_TEMPCO, g_clock_tempco) || changes;
+  changes = save_setting_if_changed(EEPROM_CLOCK_CAL_SAVED, CLOCK_CAL_SAVED) || changes;
+  changes = save_setting_if_changed(EEPROM_RADIO_MULTICAST, g_radio_multicast) || changes;
+  changes = save_setting_if_changed(EEPROM_RADIO_LISTENER_ID, g_radio_listener_id) || changes;
+  changes = save_setting_if_changed(EEPROM_RADIO_POLL_LISTENERS, g_radio_poll_listeners) || changes;
   load_settings();
   return changes;
 }
@@ -564,46 +1200,66 @@ void test_read_buttons() {
 
 uint8_t start_clock() {
   uint8_t rc = SUCCESS;
-  g_last_clock_millis = millis();
+  // picks up clockppm/clocktempco changed from the serial console
+  update_clock_tick(g_clock_celsius);
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    g_countdown.millis = g_clock_millis;
+    g_countdown.fraction_q24 = 0;
+    g_countdown.expired = false;
+    g_countdown.running = true;
+  }
   g_clock_is_running = true;
   g_front_display.animated = 1;
-  g_rear_display.use_primary_buffer = 1;
   g_rear_display.animated = 0;
-  g_front_display.use_primary_buffer = 1;
+  clear_overlays();
   return rc;
 }
 
+void stop_clock() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    g_countdown.running = false;
+    if(g_clock_is_running) {
+      g_clock_millis = g_countdown.millis;
+    }
+  }
+  g_clock_is_running = false;
+}
+
 /* Update the clock millis every time through */
-uint32_t update_clock_millis() {
-  uint32_t current_millis= millis();
-  uint32_t time_elapsed = 0;
+void update_clock_millis() {
   if(g_clock_is_running) {
-    time_elapsed = current_millis - g_last_clock_millis;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      g_clock_millis = g_countdown.millis;
+    }
   }
-  g_last_clock_millis = current_millis;
-  g_clock_millis -= time_elapsed;
 }
 
-void update_horn_state(uint32_t millis_elapsed) {
-  if(g_horn_is_on) {
-    if(g_horn_timer_millis > 0) {
-      g_horn_timer_millis -= millis_elapsed;
-      // Serial.print(F("Horn timer millis: "));
-      // Serial.println(g_horn_timer_millis);
-    } else {
-      // horn off
-      Serial.println(F("Horn OFF!"));
-      digitalWrite(PIN_HORN_RELAY, LOW);
-      g_horn_is_on = false;
+/* Use this rather than setting g_clock_millis, so a running countdown picks it up. */
+void set_clock_millis(int32_t clock_millis) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    g_clock_millis = clock_millis;
+    if(g_countdown.running) {
+      g_countdown.millis = clock_millis;
     }
   }
 }
 
-void update_uptime(uint32_t current_millis) {
-  if(current_millis - g_last_uptime_millis > 1000) {
-    // we will never take more than a second to get back here.
+void update_horn_state() {
+  // The ISR does the timing; this just reports it.
+  static bool s_horn_was_on = false;
+  if(s_horn_was_on && !g_horn_is_on) {
+    Serial.println(F("Horn OFF!"));
+  }
+  s_horn_was_on = g_horn_is_on;
+}
+
+void update_uptime() {
+  // TIMER_UPTIME, every second.  run_timers() skips the periods a slow pass fell a whole
+  // period behind on, so count the seconds that have gone by rather than the calls.
+  static uint32_t s_counted_millis = 0;
+  while(g_loop_millis - s_counted_millis >= 1000) {
+    s_counted_millis += 1000;
     g_uptime_seconds++;
-    g_last_uptime_millis = current_millis;
   }
 }
 
@@ -621,11 +1277,17 @@ void change_state(uint8_t new_state) {
 }
 
 void update_state_timeout(long addition) {
-  g_state_timeout_millis = millis() + addition;
+  g_state_timeout_expired = false;
+  start_timer(TIMER_STATE, addition, 0);
+}
+
+void state_timeout() {
+  // TIMER_STATE
+  g_state_timeout_expired = true;
 }
 
 bool is_state_timeout_expired() {
-  return millis() > g_state_timeout_millis;
+  return g_state_timeout_expired;
 }
 
 void state_init() {
@@ -635,8 +1297,7 @@ void state_init() {
     change_state(STATE_INIT);
     Serial.println(F("Type \"help\" for available commands."));
 
-    push_single(MESSAGE_HELLO);
-    command_show_message();
+    show_message(MESSAGE_HELLO, false);
 
     print_radio_mode();
 
@@ -647,9 +1308,8 @@ void state_init() {
 
   switch(s_init_state) {
   case INIT_STATE_SHOW_VERSION:
-    if(g_state_timeout_millis < millis()) {
-      push_single(MESSAGE_VERSION);
-      command_show_message();
+    if(is_state_timeout_expired()) {
+      show_message(MESSAGE_VERSION, false);
       update_state_timeout(INIT_DISPLAY_DELAY);
       s_init_state = INIT_STATE_SHOW_RADIO;
     }
@@ -659,17 +1319,16 @@ void state_init() {
     
       switch(g_radio_mode) {
       case RADIO_MODE_BROADCAST:
-	push_single(MESSAGE_RADIO_MODE_BROADCAST);
+	show_message(MESSAGE_RADIO_MODE_BROADCAST, false);
 	break;
       case RADIO_MODE_LISTEN:
-	push_single(MESSAGE_RADIO_MODE_LISTEN);
+	show_message(MESSAGE_RADIO_MODE_LISTEN, false);
 	break;
       default:
-	push_single(MESSAGE_RADIO_MODE_OFF);
+	show_message(MESSAGE_RADIO_MODE_OFF, false);
 	break;
       }
-      command_show_message();
-      g_state_timeout_millis = millis() + INIT_DISPLAY_DELAY;
+      update_state_timeout(INIT_DISPLAY_DELAY);
       s_init_state = INIT_STATE_DONE;
     }
     break;
@@ -695,28 +1354,30 @@ void state_stopped() {
   if(g_state != STATE_STOPPED) {
     // Handle the state transition
     g_front_display.animated = 0;
-    g_front_display.use_primary_buffer = 1;
-    g_clock_is_running = false;
+    clear_display_layer(&g_front_display, LAYER_TRANSITORY);
+    stop_clock();
 
     if(g_state == STATE_RUNNING) {
       // transition from STATE_RUNNING to STATE_STOPPED
-      if (g_clock_millis <= 0) {
+      if (g_countdown.expired) {
+	g_zero_to_stop_micros = micros() - g_countdown_zero_micros;
+	g_countdown.expired = false;
 	g_clock_millis = 0;
 	// show the 0 on the clock
-	// sound the horn
+	// the countdown ISR has already sounded the horn
 	Serial.println(F("HORN!"));
-	command_beep();
+	send_radio_command(RADIO_COMMAND_BEEP);
       }
     }
 
     send_radio_command(RADIO_COMMAND_CLOCK_STOPPED);
 
     change_state(STATE_STOPPED);
-    command_show_time();
+    show_time();
     Serial.println(F("Stopped."));
   }
 
-  receive_radio_message();
+  update_remote_clock();
   
   /* No events, nothing to do here. */
   if((g_button_pressed_events | g_button_released_events) == 0)
@@ -732,8 +1393,9 @@ void state_stopped() {
       // TODO show [LS]/[LiSn]
     } else {
     */
-    Serial.println(F("Starting clock because button A was clicked."));
     command_start_clock();
+    g_start_stop_reaction_micros = micros() - g_start_stop_pressed_micros;
+    Serial.println(F("Starting clock because button A was clicked."));
   }
 
   else if (BUTTON_PRESSED_NO_MODS(INPUT_RESET_30_BUTTON)) {
@@ -813,8 +1475,7 @@ void state_stopped() {
     }
 
     else if (BUTTON_PRESSED(INPUT_A)) {
-      command_read_temperature();
-      command_show_number_transitory();
+      show_number(read_temperature(), true);
     }
   }
 }
@@ -832,8 +1493,8 @@ void send_radio_command_show_time_if_necessary() {
 
   static char old_front_left = ' ';
   static char old_front_right = ' ';
-  char current_front_left = g_front_display.primary_buffer[2];
-  char current_front_right = g_front_display.primary_buffer[3];
+  char current_front_left = g_front_display.layers[LAYER_PRIMARY].buffer[FRONT_DISPLAY_BUFFER_SIZE - 2];
+  char current_front_right = g_front_display.layers[LAYER_PRIMARY].buffer[FRONT_DISPLAY_BUFFER_SIZE - 1];
 
   if((old_front_left != current_front_left) || (old_front_right != current_front_right)) {
     send_message_flag = true;
@@ -862,7 +1523,6 @@ void state_running() {
   if(g_state != STATE_RUNNING) {
     start_clock();
     update_clock_millis();
-    g_front_display.use_primary_buffer = 1;
     g_front_display.animated = 1;
     change_state(STATE_RUNNING);
     Serial.println(F("Running."));
@@ -870,18 +1530,19 @@ void state_running() {
   } 
 
   update_clock_millis();
-  command_show_time();
+  show_time();
 
-  if (g_clock_millis <= 0) {
+  if (g_countdown.expired) {
     Serial.println(F("Stopping clock because timer hit 0."));
     //clear_button_events();
     command_stop_clock();
   } 
 
   else if (BUTTON_PRESSED(INPUT_START_STOP_BUTTON)) {
-    Serial.println(F("Stopping clock because button A was pressed."));
     //clear_button_events();
     command_stop_clock();
+    g_start_stop_reaction_micros = micros() - g_start_stop_pressed_micros;
+    Serial.println(F("Stopping clock because button A was pressed."));
   }
 
   else if (BUTTON_PRESSED(INPUT_RESET_30_BUTTON)) {
@@ -902,38 +1563,32 @@ void show_setting_value(uint8_t setting_state) {
   // Serial.print(setting_state);
   // Serial.print(F(" "));
 
-  switch_to_primary_buffer(); // don't get caught writing to transitory buffer
+  clear_overlays(); // the new value should show right away, not after the setting name
 
   switch(setting_state) {
   case SETTING_STATE_HORN:
-    push_single(g_horn_tenths);
-    command_show_number();
+    show_number(g_horn_tenths, false);
     break;
   case SETTING_STATE_COLOR_MODE:
-    push_single(MESSAGE_COLOR_MODE_CUSTOM + g_color_mode);
-    command_show_message();
+    show_message(MESSAGE_COLOR_MODE_CUSTOM + g_color_mode, false);
     break;
   case SETTING_STATE_RADIO_MODE:
-    push_single(MESSAGE_RADIO_MODE_OFF + g_radio_mode);
-    command_show_message();
+    show_message(MESSAGE_RADIO_MODE_OFF + g_radio_mode, false);
     //command_state();
     break;
   case SETTING_STATE_RADIO_CHANNEL:
-    push_single(g_radio_channel);
-    command_show_number();
+    show_number(g_radio_channel, false);
     break;
   case SETTING_STATE_RADIO_STRENGTH:
-    push_single(g_radio_signal_strength);
-    command_show_number();
+    show_number(g_radio_signal_strength, false);
     break;
   }
 }
 
 void show_setting_name(uint8_t setting_state) {
-  // What we'll do is show the setting name in the transitory, which will timeout
+  // What we'll do is show the setting name in the transitory layer, which will timeout
   // and show the actual value.
-  push_single(MESSAGE_SETTING_HORN + setting_state);
-  command_show_message_transitory();
+  show_message(MESSAGE_SETTING_HORN + setting_state, true);
 }
 
 void wrap_range(int8_t *value, int8_t min, int8_t max) {
@@ -950,8 +1605,8 @@ void state_setting() {
   
   if(g_state != STATE_SETTING) {
 
-    g_front_display.use_primary_buffer = 1;
     g_front_display.animated = 0;
+    clear_display_layer(&g_front_display, LAYER_TRANSITORY);
     change_state(STATE_SETTING);
     s_setting_state = SETTING_STATE_HORN;
     update_state_timeout(SETTING_TIMEOUT_MILLIS);
@@ -966,8 +1621,7 @@ void state_setting() {
       bool changes = save_settings();
       // If there were any changes, show MESSAGE_SAVE
       if(changes) {
-	push_single(MESSAGE_SAVE);
-	command_show_message();
+	show_message(MESSAGE_SAVE, false);
 	update_state_timeout(DEFAULT_TRANSITORY_DISPLAY_MILLIS);
       } else {
 	Serial.println(F("No changes to settings"));
@@ -1002,8 +1656,8 @@ void state_setting() {
     update_state_timeout(SETTING_TIMEOUT_MILLIS);
   }
   else if(s_setting_state == SETTING_STATE_RADIO_STRENGTH) {
-    // I need a little delay before this starts.  Check the transitory buffer value.
-    if(s_signal_strength_test_running && (g_front_display.transitory_timer_millis <= 0)) {
+    // I need a little delay before this starts.  Wait for the setting name to go away.
+    if(s_signal_strength_test_running && !is_display_layer_active(&g_front_display, LAYER_TRANSITORY)) {
       s_signal_strength_test_running = send_test_packet();
       show_setting_value(s_setting_state);
       if(!s_signal_strength_test_running) {
@@ -1074,59 +1728,66 @@ void state_setting() {
 }
 
 
-long g_remote_timer_millis = 0;
-long g_last_contact_millis = 0;
+/* the listener's link watchdog */
+int16_t g_link_loss_millis = DEFAULT_LINK_LOSS_MILLIS;
+struct link_watch g_link_watch = { 0 }; // in g_loop_millis
 
-void refresh_display(struct display_info *display, long millis_elapsed) {
-  if (display->requires_refresh) {
-    /* check refresh timer to update display */
-    display->refresh_millis -= millis_elapsed;
-    if(display->refresh_millis <= 0) {
-      display_dirty(display);
-      if(display->animated) {
-	display->refresh_millis = ANIMATION_REFRESH_INTERVAL_MILLIS;
-      } else {
-	display->refresh_millis = DEFAULT_REFRESH_INTERVAL_MILLIS;
-      }
-    }
-  }
+/* the listener's copy of the broadcaster's clock is g_remote_clock */
+bool g_remote_clock_fresh = false; // a packet brought a time not shown yet
+uint32_t g_radio_rx_time_micros = 0; // when the newest time was read
+uint32_t g_radio_rx_display_micros = 0; // the same, once shown, for timing the frame; 0 for none
 
-  /* check timer for transitory to primary display buffer switch */
-  if(!display->use_primary_buffer) {
-    //Serial.print(F("TRANSITORY_TIMER_MILLIS: "));
-    //Serial.println(display->transitory_timer_millis);
-    display->transitory_timer_millis -= millis_elapsed;
-    if(display->transitory_timer_millis <= 0) {
-      switch_to_primary_buffer();
-    }
+void update_remote_clock() {
+  // every pass while listening and stopped: show a new time, and keep counting down
+  // between packets
+  if(g_radio_mode != RADIO_MODE_LISTEN || !(g_remote_clock.running || g_remote_clock_fresh))
+    return;
+  if(g_remote_clock.running)
+    advance_remote_clock(&g_remote_clock, g_loop_millis);
+  if(g_remote_clock_fresh) {
+    g_radio_rx_display_micros = g_radio_rx_time_micros;
+    g_remote_clock_fresh = false;
   }
+  g_clock_millis = g_remote_clock.millis;
+  show_time();
+}
 
-  update_display(display);
+void refresh_display_timer(struct display_info *display) {
+  display_dirty(display);
+  start_timer(display->refresh_timer,
+	      display->animated ? ANIMATION_REFRESH_INTERVAL_MILLIS : DEFAULT_REFRESH_INTERVAL_MILLIS, 0);
 }
 
-#define DEFAULT_RECOMMENDED_REFRESH 200 // millis
-#define QUICK_RECOMMENDED_REFRESH 20 // millis
+void front_refresh_timer() {
+  // TIMER_FRONT_REFRESH
+  refresh_display_timer(&g_front_display);
+}
 
-uint8_t checksum_bytes(uint8_t *b, int size) {
-  uint8_t checksum = 0;
-  for (int i = 0; i < size; i++) {
-    /*
-    Serial.print(F("b["));
-    Serial.print(i);
-    Serial.print(F("]="));
-    Serial.print(b[i]);
-    Serial.print(F(" "));
-    */
-    checksum += b[i];
-  }
-  //  Serial.println();
-  return checksum;
+void rear_refresh_timer() {
+  // TIMER_REAR_REFRESH
+  refresh_display_timer(&g_rear_display);
+}
+
+void front_expiry_timer() {
+  // TIMER_FRONT_EXPIRY
+  g_front_display.layers_changed = 1;
 }
 
-uint8_t checksum_radio_message() {
-  return checksum_bytes((uint8_t *) &g_radio_message, sizeof(g_radio_message) - 1);
+void rear_expiry_timer() {
+  // TIMER_REAR_EXPIRY
+  g_rear_display.layers_changed = 1;
 }
 
+void refresh_display(struct display_info *display, uint32_t current_millis) {
+  /* only recompose when a layer was written, or its expiry timer says one has expired */
+  if(display->layers_changed) {
+    compose_display(display, current_millis);
+  }
+}
+
+#define DEFAULT_RECOMMENDED_REFRESH 200 // millis
+#define QUICK_RECOMMENDED_REFRESH 20 // millis
+
 void print_radio_mode() {
   Serial.print(F("Radio mode: "));
   switch(g_radio_mode) {
@@ -1143,57 +1804,196 @@ void print_radio_mode() {
 }
 
 void print_radio_message() {
-  Serial.print(F(" sender_serial_number="));
-  Serial.print(g_radio_message.sender_serial_number);
   Serial.print(F(" message_serial_number="));
   Serial.print(g_radio_message.message_serial_number);
-  Serial.print(F(" command="));
-  Serial.print(g_radio_message.command);
+  Serial.print(F(" commands="));
+  Serial.print(g_radio_message.commands, BIN);
   Serial.print(F(" clock_millis="));
   Serial.print(g_radio_message.clock_millis);
   Serial.print(F(" clock_running="));
   Serial.print(g_radio_message.clock_running);
-  Serial.print(F(" checksum="));
-  Serial.print(g_radio_message.checksum);
+  Serial.print(F(" send_micros="));
+  Serial.print(g_radio_message.send_micros);
+  Serial.print(F(" offset_micros="));
+  Serial.print(g_radio_message.offset_micros);
 }
 
-void receive_radio_message() {
+bool read_radio_ack() {
+  // broadcaster, after a delivered write: any ACK payload, filed under its listener id
+  if(!g_radio.available())
+    return false;
+  uint8_t length = g_radio.getDynamicPayloadSize();
+  if(length > RADIO_ACK_SIZE) {
+    length = RADIO_ACK_SIZE + 1; // not one of ours, but still has to come out of the FIFO
+  }
+  uint8_t payload[RADIO_ACK_SIZE + 1];
+  g_radio.read(payload, length);
+  if(!decode_radio_ack(payload, length, &g_radio_ack))
+    return false;
+  if(g_radio_ack.listener_id <= RADIO_MAX_LISTENERS) {
+    struct listener_status *status = &g_listener_status[g_radio_ack.listener_id];
+    status->report = g_radio_ack;
+    status->received_millis = time_source_millis();
+    status->reports++;
+  }
+  return true;
+}
+
+void update_radio_sync(uint32_t rtt_micros, bool have_ack) {
+  // broadcaster, after a delivered write: take in the listener's times for an earlier one
+  g_sync_rtt_micros = rtt_micros;
+  if(rtt_micros < g_sync_min_rtt_micros)
+    g_sync_min_rtt_micros = rtt_micros;
+
+  if(have_ack) {
+    if(g_radio_ack.message_serial_number == g_sync_sent_serial &&
+       g_radio_ack.send_micros == g_sync_sent_micros) {
+      // the return leg is about half the quickest round trip; the rest was getting there
+      g_sync_delay_micros = g_sync_sent_rtt_micros - g_sync_min_rtt_micros / 2;
+      g_sync_offset_micros = g_radio_ack.receive_micros - (g_sync_sent_micros + g_sync_delay_micros);
+
+      // RFC 3550 interarrival jitter on the transit time
+      int32_t transit = g_radio_ack.receive_micros - g_sync_sent_micros;
+      if(g_sync_samples > 0) {
+	uint32_t d = abs(transit - g_sync_last_transit_micros);
+	g_sync_jitter_micros += ((int32_t)d - (int32_t)g_sync_jitter_micros) >> SYNC_JITTER_SHIFT;
+      }
+      g_sync_last_transit_micros = transit;
+      g_sync_samples++;
+    }
+  }
+
+  g_sync_sent_serial = g_radio_message.message_serial_number;
+  g_sync_sent_micros = g_radio_message.send_micros;
+  g_sync_sent_rtt_micros = rtt_micros;
+}
+
+void load_radio_ack(uint8_t pipe, uint16_t message_serial_number, uint32_t send_micros, uint32_t receive_micros) {
+  // listener: goes back to the broadcaster with its next packet on this pipe
+  g_radio_ack.message_serial_number = message_serial_number;
+  g_radio_ack.send_micros = send_micros;
+  g_radio_ack.receive_micros = receive_micros;
+
+  g_radio_ack.listener_id = g_radio_listener_id;
+  g_radio_ack.accepted_serial = g_radio_rx_sequence.last;
+  g_radio_ack.displayed_centis = g_clock_millis / 10;
+  g_radio_ack.flags = g_remote_clock.running ? LISTENER_FLAG_RUNNING : 0;
+  g_radio_ack.loop_max_micros = g_loop_stats.max_micros > 0xffff ? 0xffff : g_loop_stats.max_micros;
+  g_radio_ack.celsius = g_clock_celsius;
+  g_radio_ack.reset_cause = g_reset_cause;
+  uint8_t payload[RADIO_ACK_SIZE];
+  encode_radio_ack(&g_radio_ack, payload);
+  g_radio.writeAckPayload(pipe, payload, RADIO_ACK_SIZE);
+}
+
+int32_t radio_message_age_micros(uint32_t receive_micros) {
+  // listener: how old clock_millis was when we read it, or 0 if we can't tell yet
+  if(g_radio_message.offset_micros == SYNC_OFFSET_UNKNOWN)
+    return 0;
+  int32_t age = receive_micros - g_radio_message.offset_micros - g_radio_message.send_micros;
+  if(age < 0 || age > MAX_SYNC_AGE_MICROS)
+    return 0;
+  return age;
+}
+
+void service_radio_receive() {
+  /*
+    Every pass, whatever g_state: empty the RX FIFO, so nothing sits in it getting old.
+    Each packet's commands are applied in the order they came, but only the newest time
+    goes to the remote clock; update_remote_clock() shows it.
+  */
+  TIMING_SCOPE(TIMING_RADIO_RECEIVE);
   if(!g_radio_ok)
     return;
   if(g_radio_mode != RADIO_MODE_LISTEN)
     return;
-  
+  if(g_scan_state != RADIO_SCAN_IDLE)
+    return; // the radio is on some other channel
+
+  bool have_time = false;
+  int32_t newest_clock_millis = 0;
+  bool newest_clock_running = false;
+  uint8_t drained = 0;
   uint8_t pipe;
-  if (g_radio.available(&pipe)) { 
-    g_radio.read(&g_radio_message, sizeof(g_radio_message)); // read and send ACK
-    print_radio_message();
-    Serial.println();
-    
-    if(g_radio_message.checksum != checksum_radio_message()) {
-      Serial.print(F("BAD CHECKSUM ON RECEIVED RADIO MESSAGE: "));
-      Serial.println();
-    } else {
-      // check that the data makes sense
-      if(g_radio_message.command > MAX_RADIO_COMMAND) {
-	Serial.println(F("received command out of range"));
-	return;
+  while(drained < RADIO_RX_FIFO_DEPTH && g_radio.available(&pipe)) {
+    drained++;
+    uint8_t length = g_radio.getDynamicPayloadSize();
+    if(length > RADIO_PACKET_SIZE) {
+      length = RADIO_PACKET_SIZE + 1; // too long for us, but still has to come out of the FIFO
+    }
+    uint8_t packet[RADIO_PACKET_SIZE + 1];
+    g_radio.read(packet, length); // read and send ACK
+    uint32_t receive_micros = micros();
+
+    uint8_t result = decode_radio_message(packet, length, &g_radio_message);
+    if(result != RADIO_DECODE_OK) {
+      g_radio_rx_stats.bad++;
+      if(g_debug) {
+	Serial.print(F("BAD RADIO PACKET: "));
+	Serial.println(result);
       }
-      if((g_radio_message.clock_millis < -2000) || (g_radio_message.clock_millis >= 100000)) {
+      continue;
+    }
+
+    g_radio_rx_stats.packets++;
+    if(g_radio.testRPD()) {
+      g_link_stats.strong++;
+    } else {
+      g_link_stats.weak++;
+    }
+    // copies and retries share a sequence number; polls repeat the last one
+    bool repeat;
+    if(pipe == RADIO_POLL_PIPE) {
+      g_radio_rx_stats.polls++;
+      repeat = true;
+    } else {
+      repeat = !take_radio_sequence(&g_radio_rx_sequence, g_radio_message.message_serial_number,
+				    &g_radio_rx_stats.lost);
+      if(repeat)
+	g_radio_rx_stats.duplicates++;
+    }
+
+    // an ACK payload for the next packet on this pipe; a multicast one has no ACK to carry it
+    if(!g_radio_message.multicast) {
+      load_radio_ack(pipe, g_radio_message.message_serial_number, g_radio_message.send_micros, receive_micros);
+    }
+    if(g_debug) {
+      print_radio_message();
+      Serial.println();
+    }
+
+    // check that the data makes sense
+    if((g_radio_message.clock_millis < -2000) || (g_radio_message.clock_millis >= 100000)) {
+      g_radio_rx_stats.bad++;
+      if(g_debug)
 	Serial.println(F("received clock_millis out of range"));
-	return;
-      }
-      if(g_radio_message.clock_running > 1) {
-	Serial.println(F("received clock_running out of range"));
-	return;
-      }
-      
-      g_clock_millis = g_radio_message.clock_millis;
-      g_remote_clock_is_running = g_radio_message.clock_running;
+      continue;
+    }
+
+    int32_t age = radio_message_age_micros(receive_micros);
+    g_sync_age_jitter_micros += ((int32_t)abs(age - (int32_t)g_sync_age_micros) - (int32_t)g_sync_age_jitter_micros) >> SYNC_JITTER_SHIFT;
+    g_sync_age_micros = age;
 
-      switch(g_radio_message.command) {
+    if(have_time)
+      g_radio_rx_stats.stale++;
+    have_time = true;
+    newest_clock_millis = g_radio_message.clock_millis;
+    if(g_radio_message.clock_running) {
+      newest_clock_millis -= (age + 500) / 1000; // it has been counting down since it was stamped
+    }
+    newest_clock_running = g_radio_message.clock_running;
+    g_radio_rx_time_micros = receive_micros;
+
+    if(repeat)
+      continue; // its commands were taken with the first copy
+
+    // a packet can carry several commands; unknown bits are from a newer broadcaster
+    for(uint8_t command = RADIO_COMMAND_SHOW_TIME; command <= MAX_RADIO_COMMAND; command++) {
+      if(!(g_radio_message.commands & RADIO_COMMAND_BIT(command)))
+	continue;
+      switch(command) {
       case RADIO_COMMAND_SHOW_TIME:
-	command_show_time();
-	break;
+	break; // every packet carries the time
       case RADIO_COMMAND_BEEP:
 	command_beep();
 	break;
@@ -1208,61 +2008,437 @@ void receive_radio_message() {
       case RADIO_COMMAND_SIGNAL_TEST:
 	Serial.print(F("."));
 	break;
+      case RADIO_COMMAND_SWITCH_CHANNEL:
+	if(g_radio_message.channel <= MAX_RADIO_CHANNEL)
+	  apply_radio_channel(g_radio_message.channel);
+	break;
+      case RADIO_COMMAND_HEARTBEAT:
+	break; // being here was the point
       }
     }
   }
+
+  if(drained > g_radio_rx_stats.drained_max)
+    g_radio_rx_stats.drained_max = drained;
+  if(have_time) {
+    link_contact();
+    correct_remote_clock(&g_remote_clock, g_loop_millis, newest_clock_millis, newest_clock_running);
+    g_remote_clock_fresh = true;
+  }
+}
+
+void start_link_loss_timer() {
+  start_timer(TIMER_LINK_LOSS, link_loss_window(g_link_loss_millis), 0);
+}
+
+void clear_link_status() {
+  clear_display_layer(&g_front_display, LAYER_STATUS);
+  clear_display_layer(&g_rear_display, LAYER_STATUS);
+}
+
+void clear_link_lost() {
+  if(!g_link_watch.lost)
+    return;
+  g_link_watch.lost = false;
+  clear_link_status();
+}
+
+void link_contact() {
+  // listener: a valid packet came in
+  start_link_loss_timer();
+  if(link_watch_contact(&g_link_watch, g_loop_millis)) {
+    clear_link_status();
+    Serial.println(F("Radio link back"));
+  }
+}
+
+void link_loss_timer() {
+  // TIMER_LINK_LOSS: nothing valid heard for a whole window, unless linkloss grew since
+  if(g_radio_mode != RADIO_MODE_LISTEN)
+    return;
+  if(!link_watch_expired(&g_link_watch, g_loop_millis, g_link_loss_millis)) {
+    if(!g_link_watch.lost)
+      start_timer(TIMER_LINK_LOSS, link_watch_remaining(&g_link_watch, g_loop_millis, g_link_loss_millis), 0);
+    return;
+  }
+  g_remote_clock.running = false; // hold the last time; the next packet snaps it
+  char contents[MESSAGE_CHARS] = { '-', '-', 'L', 'o', ' ', ' ' };
+  two_digits(g_link_watch.losses % 100, &contents[4], &contents[5]);
+  show_overlay(LAYER_STATUS, DISPLAY_BOTH, contents, 0);
+  Serial.println(F("Radio link lost"));
 }
 
 bool send_radio_command(uint8_t radio_command) {
-  bool result = false;
+  // mark it pending: service_radio_transmit() puts everything pending in the next packet
   if(!g_radio_ok)
     return false;
   if(g_radio_mode != RADIO_MODE_BROADCAST)
     return false;
 
-  unsigned long start_timer, end_timer;
-  unsigned long timeout_millis = millis() + MAX_TRANSMISSION_MILLIS;
+  // a SHOW_TIME already pending will carry the newest time when it goes
+  g_radio_tx_pending |= RADIO_COMMAND_BIT(radio_command);
+  g_radio_tx_stats.queued++;
+  return true;
+}
 
-  int loop_max = 1 + MAX_TRANSMISSION_RETRIES;
+void set_radio_target(uint8_t target) {
+  // write to everyone's address, or to one listener's for a poll
+  static uint8_t s_target = 0;
+  if(target == s_target)
+    return;
+  byte address[5] = RADIO_ADDRESS;
+  if(target > 0)
+    address[0] = RADIO_POLL_ADDRESS_BYTE(target);
+  g_radio.openWritingPipe(address);
+  s_target = target;
+}
+
+void start_radio_transmit() {
+  // stamp the payload as late as possible and hand it over; the transceiver does the rest
+  // the signal test counts ACKs, so it never goes multicast
+  g_radio_message.multicast = g_radio_multicast && g_radio_tx_target == 0 &&
+    !(g_radio_tx_commands & RADIO_COMMAND_BIT(RADIO_COMMAND_SIGNAL_TEST));
+  g_radio_message.clock_millis = g_clock_millis;
+  g_radio_message.clock_running = g_clock_is_running;
+  g_radio_message.commands = g_radio_tx_commands;
+  g_radio_message.channel = (g_radio_tx_commands & RADIO_COMMAND_BIT(RADIO_COMMAND_SWITCH_CHANNEL))
+    ? g_radio_switch_channel : g_radio_channel;
+  g_radio_message.offset_micros = g_radio_message.multicast ? SYNC_OFFSET_UNKNOWN : g_sync_offset_micros;
+  if(g_radio_message.multicast && g_radio_power.level != RF24_PA_MAX)
+    set_radio_power(RF24_PA_MAX); // no ACKs to tell us a lower level still gets through
+  g_radio_tx_start_micros = micros();
+  g_radio_message.send_micros = g_radio_tx_start_micros;
+  if(g_radio_tx_target == 0)
+    g_radio_tx_last_millis = g_loop_millis;
+  encode_radio_message(&g_radio_message, g_radio_packet);
+
+  set_radio_target(g_radio_tx_target);
+  g_radio.startFastWrite(g_radio_packet, RADIO_PACKET_SIZE, g_radio_message.multicast);
+  g_radio_tx_attempts++;
+  g_radio_tx_state = RADIO_TX_SENDING;
+
+  if(g_debug) {
+    print_radio_message();
+    Serial.println();
+  }
+}
 
-  if(radio_command == RADIO_COMMAND_SIGNAL_TEST)
-    loop_max = 1;
-  
-  for(int i = 0; i < loop_max; i++) {
-    wdt_reset(); // things could take a while
-    
-    g_radio_message.sender_serial_number = 111;
-    g_radio_message.message_serial_number = ++g_message_serial_number;
-    g_radio_message.clock_millis = g_clock_millis;
-    g_radio_message.clock_running = g_clock_is_running;
-    g_radio_message.command = radio_command;
-    g_radio_message.checksum = checksum_radio_message();
-  
-    start_timer = micros();
-    result = g_radio.write(&g_radio_message, sizeof(g_radio_message));
-    end_timer = micros();
+bool poll_radio_transmit() {
+  // one status read: true once the packet in the air was ACKed or the auto-retries ran out
+  // (a multicast packet has no ACK, and counts as done once it is sent)
+  bool tx_ok, tx_fail, rx_ready;
+  g_radio.whatHappened(tx_ok, tx_fail, rx_ready);
+  if(!tx_ok && !tx_fail)
+    return false;
+  g_radio_tx_done_micros = micros();
+  g_radio_tx_ok = tx_ok;
+  g_radio_tx_state = RADIO_TX_DONE;
+  return true;
+}
 
+void update_link_stats(bool delivered) {
+  // after a packet that asked for an ACK; ARC is how many times the transceiver resent it
+  uint8_t retransmits = g_radio.getARC();
+  g_link_stats.last_retransmits = retransmits;
+  g_link_stats.retransmits += retransmits;
+  g_link_stats.retransmits_x16 += ((int16_t)(retransmits << 4) - (int16_t)g_link_stats.retransmits_x16) >> RETRANSMIT_AVERAGE_SHIFT;
+  g_link_stats.loss_history = (g_link_stats.loss_history << 1) | (delivered ? 0 : 1);
+  if(g_link_stats.history_length < 32)
+    g_link_stats.history_length++;
+}
+
+void set_radio_power(uint8_t level) {
+  g_radio_power.level = level;
+  g_radio_power.clean = 0;
+  g_radio_power.held = 0;
+  g_radio_power.holdoff = RADIO_PA_HOLD_PACKETS;
+  g_radio.setPALevel(level);
+}
+
+void update_radio_power() {
+  // on a new mode or channel: a broadcaster takes the level it settled on here before
+  static int8_t s_channel = -1;
+  static uint8_t s_mode = RADIO_MODE_OFF;
+  if(!g_radio_ok || (g_radio_channel == s_channel && g_radio_mode == s_mode))
+    return;
+  s_channel = g_radio_channel;
+  s_mode = g_radio_mode;
+
+  // never settled on this channel: start loud and come down, rather than lose packets
+  // finding out how quiet it can be
+  uint8_t level = RF24_PA_MAX;
+  if(g_radio_mode == RADIO_MODE_BROADCAST && !g_radio_multicast) {
+    level = saved_radio_power(g_radio_channel);
+    if(level >= RADIO_PA_LEVELS)
+      level = RF24_PA_MAX;
+  }
+  g_radio_power.backoff = 0;
+  g_radio_power.last_step_down = false;
+  set_radio_power(level);
+}
+
+uint8_t saved_radio_power(uint8_t channel) {
+  // RADIO_PA_LEVELS if the broadcaster hasn't settled on one there
+  uint8_t level = EEPROM.read(EEPROM_RADIO_PA_LEVELS + channel);
+  return level < RADIO_PA_LEVELS ? level : RADIO_PA_LEVELS;
+}
+
+void adapt_radio_power(bool delivered) {
+  // broadcaster, after each packet that asked for an ACK, with the link stats updated
+  struct radio_power *power = &g_radio_power;
+  if(g_radio_mode != RADIO_MODE_BROADCAST)
+    return;
+  if(power->holdoff > 0)
+    power->holdoff--;
+  if(power->held < 0xffff)
+    power->held++;
+  if(delivered && g_link_stats.last_retransmits == 0) {
+    if(power->clean < 0xffff)
+      power->clean++;
+  } else {
+    power->clean = 0;
+  }
+
+  uint8_t recent_losses = 0;
+  for(uint8_t h = g_link_stats.loss_history & 0xff; h != 0; h &= h - 1) {
+    recent_losses++;
+  }
+
+  if(power->holdoff > 0)
+    return;
+  if(power->level < RF24_PA_MAX &&
+     (recent_losses >= RADIO_PA_UP_LOSSES || g_link_stats.retransmits_x16 >= RADIO_PA_UP_RETRANSMITS_X16)) {
+    // a step down that hadn't settled is being taken back
+    if(power->last_step_down && power->held < RADIO_PA_SAVE_PACKETS && power->backoff < RADIO_PA_MAX_BACKOFF)
+      power->backoff++;
+    power->last_step_down = false;
+    power->steps_up++;
+    set_radio_power(power->level + 1);
+  } else if(power->level > RF24_PA_MIN && power->clean >= (RADIO_PA_CLEAN_PACKETS << power->backoff)) {
+    power->last_step_down = true;
+    power->steps_down++;
+    set_radio_power(power->level - 1);
+  } else if(power->held == RADIO_PA_SAVE_PACKETS) {
+    save_setting_if_changed(EEPROM_RADIO_PA_LEVELS + g_radio_channel, power->level);
+  }
+}
+
+void finish_radio_transmit() {
+  uint32_t airtime = g_radio_tx_done_micros - g_radio_tx_start_micros;
+  if(airtime > g_radio_tx_stats.airtime_max_micros)
+    g_radio_tx_stats.airtime_max_micros = airtime;
+  g_radio_power.airtime_micros[g_radio_power.level] += airtime;
+  if(!g_radio_message.multicast)
+    update_link_stats(g_radio_tx_ok);
+
+  if(!g_radio_tx_ok)
+    g_radio.flush_tx(); // a failed payload stays in the FIFO
+  g_radio.txStandBy(); // FIFO is empty, so this only drops CE
+  if(!g_radio_message.multicast && g_radio_tx_target == 0)
+    adapt_radio_power(g_radio_tx_ok); // not polls: a listener id that isn't there never answers
+
+  if(g_radio_tx_ok) {
+    bool have_ack = read_radio_ack();
+    if(g_radio_tx_target > 0) {
+      struct listener_health *health = &g_listener_health[g_radio_tx_target - 1];
+      health->answers++;
+      health->last_answer_millis = time_source_millis();
+      health->rtt_micros = airtime;
+    } else if(!g_radio_message.multicast) {
+      update_radio_sync(airtime, have_ack);
+    } else if(g_radio_tx_attempts < RADIO_MULTICAST_COPIES) {
+      start_radio_transmit(); // the next copy
+      return;
+    }
+    g_radio_tx_stats.delivered++;
+  } else {
     if(g_debug) {
-      print_radio_message();
-      Serial.println();
+      Serial.print(F("Transmission failed or timed out after "));
+      Serial.print(airtime);
+      Serial.println(F(" microseconds"));
     }
-  
-    if (!result) {
-      // payload was not delivered
-      if(g_debug) {
-	Serial.print(F("Transmission failed or timed out after "));
-	Serial.print(end_timer - start_timer);
-	Serial.println(F(" microseconds"));
-      }
-      if(millis() > timeout_millis) {
-	//Serial.println(F("Transmission timeout."));
-	return result;
-      }	
+    // the signal test and polls count each try; anything else gets its retries
+    uint8_t max_attempts = ((g_radio_tx_commands & RADIO_COMMAND_BIT(RADIO_COMMAND_SIGNAL_TEST)) || g_radio_tx_target > 0)
+      ? 1 : 1 + MAX_TRANSMISSION_RETRIES;
+    if(g_radio_tx_attempts < max_attempts &&
+       (int32_t)(time_source_millis() - g_radio_tx_deadline_millis) <= 0) {
+      start_radio_transmit();
+      return;
+    }
+    g_radio_tx_stats.failed++;
+  }
+  g_radio_tx_state = RADIO_TX_IDLE;
+
+  if(g_radio_tx_commands & RADIO_COMMAND_BIT(RADIO_COMMAND_SWITCH_CHANNEL)) {
+    if(!g_radio_tx_ok && ++g_radio_switch_attempts < RADIO_SWITCH_ATTEMPTS) {
+      send_radio_command(RADIO_COMMAND_SWITCH_CHANNEL); // until a listener has it, or we give up
     } else {
-      return result;
+      apply_radio_channel(g_radio_switch_channel);
     }
   }
-  return result;
+
+  if(g_radio_tx_commands & RADIO_COMMAND_BIT(RADIO_COMMAND_SIGNAL_TEST)) {
+    if(g_radio_tx_ok) {
+      g_radio_signal_strength++;
+      Serial.print(F("+"));
+    } else {
+      Serial.print(F("-"));
+    }
+  }
+}
+
+void service_radio_transmit() {
+  /*
+    Called every pass.  Each step is a status read or a payload write over SPI, so a pass
+    never waits on the air.  The deadline reads the time source fresh, as the signal test
+    calls us in a loop of its own.
+  */
+  TIMING_SCOPE(TIMING_RADIO_SEND);
+  if(g_scan_state != RADIO_SCAN_IDLE)
+    return; // anything pending goes when the scan is done
+  if(g_radio_tx_state == RADIO_TX_SENDING && !poll_radio_transmit()) {
+    if((int32_t)(time_source_millis() - g_radio_tx_deadline_millis) <= 0)
+      return; // still in the air
+    // the transceiver should have given up long ago; take the payload back
+    g_radio_tx_stats.timed_out++;
+    g_radio_tx_done_micros = micros();
+    g_radio_tx_ok = false;
+    g_radio_tx_state = RADIO_TX_DONE;
+  }
+
+  if(g_radio_tx_state == RADIO_TX_DONE)
+    finish_radio_transmit();
+
+  if(g_radio_tx_state == RADIO_TX_IDLE && g_radio_tx_pending) {
+    g_radio_tx_target = 0;
+    g_radio_tx_commands = g_radio_tx_pending;
+    g_radio_tx_pending = 0;
+    for(uint8_t c = g_radio_tx_commands & (g_radio_tx_commands - 1); c; c &= c - 1) {
+      g_radio_tx_stats.batched++; // every command after the first
+    }
+    g_radio_tx_stats.packets++;
+    // copies and retries are the same packet, so they keep its sequence number
+    g_radio_message.message_serial_number = ++g_message_serial_number;
+    g_radio_tx_attempts = 0;
+    g_radio_tx_deadline_millis = time_source_millis() + MAX_TRANSMISSION_MILLIS;
+    start_radio_transmit();
+  } else if(g_radio_tx_state == RADIO_TX_IDLE && g_radio_poll_due) {
+    // only the time and the last sequence number, so the listener takes it as a repeat
+    g_radio_tx_target = g_radio_poll_due;
+    g_radio_poll_due = 0;
+    g_radio_tx_commands = 0;
+    g_listener_health[g_radio_tx_target - 1].polls++;
+    g_radio_tx_attempts = 0;
+    g_radio_tx_deadline_millis = time_source_millis() + MAX_TRANSMISSION_MILLIS;
+    start_radio_transmit();
+  }
+}
+
+void reset_radio_transmit() {
+  // on a radio mode change: whatever was queued or in the air is for the old mode
+  if(g_radio_tx_state != RADIO_TX_IDLE) {
+    g_radio.flush_tx();
+    g_radio.txStandBy();
+  }
+  g_radio_tx_state = RADIO_TX_IDLE;
+  g_radio_tx_pending = 0;
+  g_radio_poll_due = 0;
+}
+
+void apply_radio_channel(uint8_t channel) {
+  // both ends of a channel switch: move, and stay moved after a power cycle
+  g_radio_channel = channel;
+  update_radio();
+  save_settings();
+}
+
+bool switch_radio_channel(uint8_t channel) {
+  // a broadcaster tells its listeners first, and follows once the packet is done
+  if(channel > MAX_RADIO_CHANNEL)
+    return false;
+  if(g_radio_mode != RADIO_MODE_BROADCAST) {
+    apply_radio_channel(channel);
+    return true;
+  }
+  g_radio_switch_channel = channel;
+  g_radio_switch_attempts = 0;
+  return send_radio_command(RADIO_COMMAND_SWITCH_CHANNEL);
+}
+
+bool start_channel_scan() {
+  if(!g_radio_ok || g_radio_tx_state != RADIO_TX_IDLE)
+    return false;
+  if(g_radio_mode == RADIO_MODE_BROADCAST && g_clock_is_running)
+    return false; // the listeners would go a couple of seconds without the time
+  memset(g_scan_hits, 0, sizeof(g_scan_hits));
+  g_scan_channel = MIN_RADIO_CHANNEL;
+  g_scan_sample = 0;
+  g_scan_done = false;
+  g_radio.setChannel(g_scan_channel * 8);
+  g_radio.startListening();
+  g_scan_listen_micros = micros();
+  g_scan_state = RADIO_SCAN_LISTENING;
+  return true;
+}
+
+void service_channel_scan() {
+  // one carrier reading a pass, so a scan never holds up the loop
+  if(g_scan_state != RADIO_SCAN_LISTENING)
+    return;
+  if(micros() - g_scan_listen_micros < RADIO_SCAN_DWELL_MICROS)
+    return;
+
+  if(g_radio.testRPD())
+    g_scan_hits[g_scan_channel]++;
+  g_radio.stopListening();
+
+  if(++g_scan_sample >= RADIO_SCAN_SAMPLES) {
+    g_scan_sample = 0;
+    g_scan_channel++;
+  }
+  if(g_scan_channel > MAX_RADIO_CHANNEL) {
+    g_scan_state = RADIO_SCAN_IDLE;
+    g_scan_done = true;
+    // back to where we were; update_radio() only re-applies the mode on a change
+    g_radio.setChannel(g_radio_channel * 8);
+    if(g_radio_mode == RADIO_MODE_LISTEN)
+      radio_listen();
+    Serial.print(F("Channel scan done, quietest is "));
+    Serial.println(quietest_channel());
+    return;
+  }
+  g_radio.setChannel(g_scan_channel * 8);
+  g_radio.startListening();
+  g_scan_listen_micros = micros();
+}
+
+int8_t quietest_channel() {
+  // from the last scan, staying put on a tie; -1 if there hasn't been one
+  if(!g_scan_done)
+    return -1;
+  int8_t best = g_radio_channel;
+  for(int8_t channel = MIN_RADIO_CHANNEL; channel <= MAX_RADIO_CHANNEL; channel++) {
+    if(g_scan_hits[channel] < g_scan_hits[best])
+      best = channel;
+  }
+  return best;
+}
+
+void radio_poll_timer() {
+  // broadcaster: ask the next listener id whether it is there
+  static uint8_t s_listener = 0;
+  if(g_radio_mode != RADIO_MODE_BROADCAST || g_radio_poll_listeners <= 0)
+    return;
+  s_listener = s_listener % min(g_radio_poll_listeners, RADIO_MAX_LISTENERS) + 1;
+  g_radio_poll_due = s_listener;
+}
+
+void radio_heartbeat_timer() {
+  // broadcaster: say something if we have been quiet for most of a heartbeat
+  if(g_radio_mode != RADIO_MODE_BROADCAST)
+    return;
+  if(heartbeat_due(g_loop_millis, g_radio_tx_last_millis))
+    send_radio_command(RADIO_COMMAND_HEARTBEAT);
 }
 
 uint8_t g_test_packet_count = 0;
@@ -1285,18 +2461,18 @@ bool prepare_radio_signal_test() {
 }
 
 bool send_test_packet() {
-  // return TRUE while there are more test packets to send.
+  // return TRUE while there are more test packets to send, or the last is still in the air.
+  // Each one is counted in finish_radio_transmit() when it is ACKed.
+  wdt_reset();
+  service_radio_transmit();
+  if(g_radio_tx_state != RADIO_TX_IDLE || g_radio_tx_pending)
+    return true;
   if(g_test_packet_count >= 99)
     return false;
 
-  wdt_reset();
   g_test_packet_count++;
-  if(send_radio_command(RADIO_COMMAND_SIGNAL_TEST)) {
-    g_radio_signal_strength++;	
-    Serial.print(F("+"));
-  } else {
-    Serial.print(F("-"));
-  }
+  if(!send_radio_command(RADIO_COMMAND_SIGNAL_TEST))
+    return false;
   return true;
 }
 
@@ -1306,24 +2482,21 @@ void complete_radio_signal_test() {
 
 void loop() {
 
+  // sleep until a button, the countdown, the horn, serial input or the tick needs us
+  wait_for_event();
+  snapshot_loop_time(); // this pass's "now", for everything below
+  uint8_t pass_state = g_state;
+
   wdt_reset();
   
-  // Grab the current inputs as updated by the pin change ISRs, only here.
-  g_inputs = g_inputs_volatile;
-
-  // Any button state changes since the last?
-  uint8_t transitions = g_inputs ^ g_last_inputs;
-  g_last_inputs = g_inputs;
-
-  if (transitions) {
-    // let's see what happened that we need to handle
-    g_button_pressed_events = g_inputs & transitions;
-    g_button_released_events = ~g_inputs & transitions;
-    // if(g_debug) {
-    //   Serial.println("====================TRANSITIONS==================");
-    //   command_inputs(); // show the inputs and history for debug
-    // }
-  }
+  TIMING_START(TIMING_INPUT);
+  // Take the input edges the pin change ISRs queued, only here.
+  drain_input_queue();
+  // if(g_debug && (g_button_pressed_events | g_button_released_events)) {
+  //   Serial.println("====================TRANSITIONS==================");
+  //   command_inputs(); // show the inputs and history for debug
+  // }
+  TIMING_END(TIMING_INPUT);
 
   /* color mode animation needs rapid refresh */
   if(g_color_mode > 4) {
@@ -1331,14 +2504,13 @@ void loop() {
   }
   
   /* Time updates for the loop. */
-  uint32_t current_time = millis();
-  uint32_t millis_elapsed = current_time - g_last_loop_millis;
-  g_last_loop_millis = current_time;
+  uint32_t current_time = g_loop_millis;
+  run_timers(current_time);
 
-  // if the state has changed, we need to mark the display dirty.
-  refresh_display(&g_front_display, millis_elapsed);
-  refresh_display(&g_rear_display, millis_elapsed);
+  // read the radio before the state handler, whatever the state, so it sees the newest time
+  service_radio_receive();
 
+  TIMING_START(TIMING_STATE);
   switch(g_state) {
   case STATE_UNINITIALIZED:
     state_init();
@@ -1358,17 +2530,46 @@ void loop() {
   default:
     break;
   }
+  TIMING_END(TIMING_STATE);
 
-  // if(g_debug) Serial.println(F("loop(): Done handling g_state"));
+  // start anything the state handler queued, or finish what is in the air
+  service_channel_scan();
+  service_radio_transmit();
 
-  update_horn_state(millis_elapsed);
-  update_uptime(current_time);
+  // if(g_debug) Serial.println(F("loop(): Done handling g_state"));
 
+  // Compose after the state handler, so whatever it changed goes out in this frame,
+  // on both displays at once.
+  TIMING_START(TIMING_DISPLAY_FRONT);
+  refresh_display(&g_front_display, current_time);
+  TIMING_END(TIMING_DISPLAY_FRONT);
+  TIMING_START(TIMING_DISPLAY_REAR);
+  refresh_display(&g_rear_display, current_time);
+  TIMING_END(TIMING_DISPLAY_REAR);
+  TIMING_START(TIMING_DISPLAY_COMMIT);
+  update_displays();
+  TIMING_END(TIMING_DISPLAY_COMMIT);
+  if(g_radio_rx_display_micros != 0) {
+    // a received time went out in this frame
+    g_radio_rx_stats.display_micros = micros() - g_radio_rx_display_micros;
+    if(g_radio_rx_stats.display_micros > g_radio_rx_stats.display_max_micros)
+      g_radio_rx_stats.display_max_micros = g_radio_rx_stats.display_micros;
+    g_radio_rx_display_micros = 0;
+  }
+
+  TIMING_START(TIMING_HORN);
+  update_horn_state();
+  TIMING_END(TIMING_HORN);
+
+  TIMING_START(TIMING_SERIAL);
   process_serial_input();
+  TIMING_END(TIMING_SERIAL);
 
   // do this at the end, so we don't erase the state of the inputs for the command processor to see
   clear_button_events();
 
+  record_loop_time(pass_state);
+
   // if(g_debug) {
   //   Serial.println(F("loop(): at end.  inputs:"));
   //   command_inputs();
@@ -1402,7 +2603,8 @@ void print_inputs(uint8_t inputs)  {
   <__D__>
 
   The way the LED string is wired up, it goes counter-clockwise from E:
-  EDCBAFG. So you need to keep that in mind as you specify segment pixel offsets.
+  EDCBAFG (WIRING_ORDER_SPIRAL_FROM_E). So you need to keep that in mind as you specify
+  segment pixel offsets.
  
   We could start the wiring at A, but the pixel string needs to go in a continuous spiral,
   so we would have to splice.
@@ -1410,7 +2612,7 @@ void print_inputs(uint8_t inputs)  {
 
 
 void neopixel_segment(Adafruit_NeoPixel *pixels, uint8_t segment) {
-  for (int16_t i = 0; i < PIXELS_PER_SEGMENT; i++) {
+  for (int16_t i = 0; i < front_digit::pixels_per_segment; i++) {
     neopixel_segment_pixel(pixels, segment, i);
   }
 }
@@ -1489,17 +2691,16 @@ void led_pixel(Adafruit_NeoPixel *pixels, uint8_t pixel_index) {
 }
 
 void neopixel_segment_pixel(Adafruit_NeoPixel *pixels, uint8_t segment, uint8_t offset) {
-  uint8_t pixel_index = PIXELS_PER_SEGMENT * segment + offset;
-  led_pixel(pixels, pixel_index);
+  led_pixel(pixels, front_digit::pixel(segment, offset));
 }
 
 void  display_neopixels_char(Adafruit_NeoPixel *pixels, char c) {
   pixels->clear();
 
-  if(g_clock_is_running || g_remote_clock_is_running) {
+  if(g_clock_is_running || g_remote_clock.running) {
     // turn on the last pixels in each string as the running indicator.
     // One goes to the front, one to the back.
-    led_pixel(pixels, LED_COUNT - 1);
+    led_pixel(pixels, front_digit::indicator_pixel);
   }
 
   uint8_t segments = lookup_segments(c);
@@ -1510,34 +2711,33 @@ void  display_neopixels_char(Adafruit_NeoPixel *pixels, char c) {
     if (c=='.') {
       neopixel_segment_pixel(pixels, SEGMENT_C, 0);
     } else if (c=='b') {
-      neopixel_segment_pixel(pixels, SEGMENT_A, PIXELS_PER_SEGMENT-1);
+      neopixel_segment_pixel(pixels, SEGMENT_A, front_digit::pixels_per_segment-1);
     } else if (c=='C') {
-      neopixel_segment_pixel(pixels, SEGMENT_B, PIXELS_PER_SEGMENT-1);
+      neopixel_segment_pixel(pixels, SEGMENT_B, front_digit::pixels_per_segment-1);
       neopixel_segment_pixel(pixels, SEGMENT_C, 0);
     } else if (c=='d') {
       neopixel_segment_pixel(pixels, SEGMENT_A, 0);
     } else if (c=='h') {
-      neopixel_segment_pixel(pixels, SEGMENT_A, PIXELS_PER_SEGMENT-1);
+      neopixel_segment_pixel(pixels, SEGMENT_A, front_digit::pixels_per_segment-1);
     } else if (c=='i') {
-      neopixel_segment_pixel(pixels, SEGMENT_F, PIXELS_PER_SEGMENT-2);
+      neopixel_segment_pixel(pixels, SEGMENT_F, front_digit::pixels_per_segment-2);
       neopixel_segment_pixel(pixels, SEGMENT_D, 0);
     } else if (c=='j') {
       neopixel_segment_pixel(pixels, SEGMENT_B, 2);
     } else if (c=='n') {
-      neopixel_segment_pixel(pixels, SEGMENT_F, PIXELS_PER_SEGMENT-1);
+      neopixel_segment_pixel(pixels, SEGMENT_F, front_digit::pixels_per_segment-1);
     } else if (c=='r') {
-      neopixel_segment_pixel(pixels, SEGMENT_F, PIXELS_PER_SEGMENT-1);
+      neopixel_segment_pixel(pixels, SEGMENT_F, front_digit::pixels_per_segment-1);
     } else if (c=='S') {
-      neopixel_segment_pixel(pixels, SEGMENT_B, PIXELS_PER_SEGMENT-1);
-      neopixel_segment_pixel(pixels, SEGMENT_E, PIXELS_PER_SEGMENT-1);
+      neopixel_segment_pixel(pixels, SEGMENT_B, front_digit::pixels_per_segment-1);
+      neopixel_segment_pixel(pixels, SEGMENT_E, front_digit::pixels_per_segment-1);
     } else if (c=='t') {
       neopixel_segment_pixel(pixels, SEGMENT_G, 0);
       neopixel_segment_pixel(pixels, SEGMENT_G, 1);
       neopixel_segment_pixel(pixels, SEGMENT_G, 2);
     }
 
-    pixels->show();
-    // delay(50);
+    // The pixels are only staged here; commit_frame() does the show().
     // Just be careful not to update the display too often.
     // We update it every .1 seconds.
   }
@@ -1573,30 +2773,55 @@ void update_rgb(uint8_t pixel_index) {
   }
 }
 
-void display_tm1637_string(char *buf) {
-  char segment_data[4]; // tm1637 has only 4 characters
+void stage_tm1637_string(char *buf) {
+  uint8_t *segment_data = g_rear_segments; // tm1637 has only 4 characters
   for (int i=0; i<4; i++) {
-    segment_data[i] =lookup_segments(buf[i]);
+    char c = buf[i] & ~REAR_COLON;
+    segment_data[i] =lookup_segments(c);
 
     // Override to turn on bottom segment to represent a '.'
     // Rather do this here than complicate the code for the LEDs.
-    if(buf[i]=='.') {
+    if(c=='.') {
       segment_data[i] |= SEG_D;
     }
   }    
-  if(g_clock_is_running) {
-    // show the colon
+  if(g_clock_is_running || (buf[1] & REAR_COLON)) {
+    // show the colon; for hundredths it stands in for the decimal point
     segment_data[1] |= SEG_DP;
   }
+}
 
-  g_tm1637_display.setSegments(segment_data);
+void commit_tm1637() {
+  // Only write the span of digits that changed.  Counting down in hundredths that is
+  // usually one or two digits.
+  int first = 0;
+  int last = REAR_DISPLAY_BUFFER_SIZE - 1;
+  while(first <= last && g_rear_segments[first] == g_rear_committed_segments[first])
+    first++;
+  while(last >= first && g_rear_segments[last] == g_rear_committed_segments[last])
+    last--;
+  if(first > last)
+    return;
+
+  uint32_t start_micros = micros();
+  g_tm1637_display.setSegments(&g_rear_segments[first], last - first + 1, first);
+  memcpy(&g_rear_committed_segments[first], &g_rear_segments[first], last - first + 1);
+
+  g_rear_commit_micros = micros() - start_micros;
+  if(g_rear_commit_micros > g_rear_commit_max_micros) {
+    g_rear_commit_max_micros = g_rear_commit_micros;
+  }
+  if(g_rear_commit_micros > REAR_COMMIT_BUDGET_MICROS) {
+    g_rear_commit_overruns++;
+  }
+  g_rear_commit_count++;
 }
 
-void fill_display_buffer(struct display_info *display, char *buffer, char *contents) {
+void fill_display_buffer(struct display_info *display, char *buffer, const char *contents) {
   memcpy(buffer, contents, display->buffer_size);
 }  
 
-int compare_display_buffer(struct display_info *display, char *buffer, char *contents) {
+int compare_display_buffer(struct display_info *display, char *buffer, const char *contents) {
   int i;
   for (i = 0; i<display->buffer_size; i++) {
     if(buffer[i] > contents[i]) return 1;
@@ -1605,69 +2830,176 @@ int compare_display_buffer(struct display_info *display, char *buffer, char *con
   return 0;
 }  
 
-int compare_active_display_buffer(struct display_info *display, char *contents) {
-  char *display_buf = display->use_primary_buffer ? 
-    display->primary_buffer : display->transitory_buffer;
-  return compare_display_buffer(display, display_buf, contents);
+void set_display_layer(struct display_info *display, uint8_t layer, const char *contents,
+		       uint16_t duration_millis) {
+  // duration_millis of 0 means the layer stays up until it is cleared.
+  struct display_layer *l = &display->layers[layer];
+
+  if(!l->active || compare_display_buffer(display, l->buffer, contents) != 0) {
+    fill_display_buffer(display, l->buffer, contents);
+    l->active = 1;
+    display->layers_changed = 1;
+  }
+
+  if(duration_millis > 0) {
+    l->expires = 1;
+    l->expires_millis = g_loop_millis + duration_millis;
+    display->layers_changed = 1;
+  } else if(l->expires) {
+    l->expires = 0;
+    display->layers_changed = 1;
+  }
 }
 
-void fill_active_display_buffer(struct display_info *display, char *contents) {
-  char *display_buf = display->use_primary_buffer ? 
-    display->primary_buffer : display->transitory_buffer;
-  fill_display_buffer(display, display_buf, contents);
+void clear_display_layer(struct display_info *display, uint8_t layer) {
+  // the primary layer is the bottom of the stack; it is always active.
+  struct display_layer *l = &display->layers[layer];
+  if(layer != LAYER_PRIMARY && l->active) {
+    l->active = 0;
+    l->expires = 0;
+    display->layers_changed = 1;
+  }
 }
 
-void fill_primary_display_buffer(struct display_info *display, char *contents) {
-  fill_display_buffer(display, display->primary_buffer, contents);
-}  
+void clear_overlays() {
+  for(int i = LAYER_PRIMARY + 1; i < DISPLAY_LAYER_COUNT; i++) {
+    clear_display_layer(&g_front_display, i);
+    clear_display_layer(&g_rear_display, i);
+  }
+}
 
-void fill_transitory_display_buffer(struct display_info *display, char *contents) {
-  fill_display_buffer(display, display->transitory_buffer, contents);
-}  
+bool is_display_layer_active(struct display_info *display, uint8_t layer) {
+  // an expired layer only gets turned off when the display is composed,
+  // so check the expiry time as well.
+  struct display_layer *l = &display->layers[layer];
+  if(!l->active)
+    return false;
+  return !(l->expires && (int32_t)(g_loop_millis - l->expires_millis) >= 0);
+}
 
-void switch_to_transitory_buffer() {
-  g_front_display.use_primary_buffer = g_rear_display.use_primary_buffer = 0;
-  g_front_display.transitory_timer_millis = g_rear_display.transitory_timer_millis = DEFAULT_TRANSITORY_DISPLAY_MILLIS;
-  displays_dirty();
+void compose_display(struct display_info *display, uint32_t current_millis) {
+  struct display_layer *top = &display->layers[LAYER_PRIMARY];
+  bool expiry_pending = false;
+  uint32_t next_expiry_millis = 0;
+
+  for(int i = LAYER_PRIMARY; i < DISPLAY_LAYER_COUNT; i++) {
+    struct display_layer *l = &display->layers[i];
+    if(!l->active)
+      continue;
+
+    if(l->expires) {
+      if((int32_t)(current_millis - l->expires_millis) >= 0) {
+	l->active = 0;
+	l->expires = 0;
+	continue;
+      }
+      if(!expiry_pending || (int32_t)(l->expires_millis - next_expiry_millis) < 0) {
+	next_expiry_millis = l->expires_millis;
+	expiry_pending = true;
+      }
+    }
+    top = l;
+  }
+
+  if(expiry_pending) {
+    start_timer(display->expiry_timer, next_expiry_millis - current_millis, 0);
+  } else {
+    stop_timer(display->expiry_timer);
+  }
+
+  if(compare_display_buffer(display, display->output_buffer, top->buffer) != 0) {
+    fill_display_buffer(display, display->output_buffer, top->buffer);
+    display_dirty(display);
+  }
+  display->layers_changed = 0;
 }
 
-void switch_to_primary_buffer() {
-  g_front_display.use_primary_buffer = g_rear_display.use_primary_buffer = 1;
-  g_front_display.transitory_timer_millis = g_rear_display.transitory_timer_millis = 0;
-  displays_dirty();
+/*
+  Output is done a frame at a time, like vsync: every dirty display is rendered into
+  staging (the NeoPixel objects' pixel buffers, and g_rear_segments for the TM1637),
+  and only then are they all committed to the hardware back to back.  That way the
+  front and rear never show different times because one was rendered before the
+  state handler ran and the other after.
+
+  The rear goes first: the TM1637 is bit-banged and slow, and it shows each digit as
+  it is written, while a NeoPixel string only latches at the end of its show().  So
+  ending on the LEDs keeps the two changes closest together.
+*/
+
+void stage_front_display(char *display_buf) {
+  for(int i = 0; i < FRONT_DIGIT_COUNT; i++) {
+    display_neopixels_char(&g_front_digits[i], display_buf[i]);
+  }
 }
 
-void update_front_display(char *display_buf) {
-  display_neopixels_char(&g_left_digit, display_buf[2]);
-  display_neopixels_char(&g_right_digit, display_buf[3]);
+void stage_rear_display(char *display_buf) {
+  stage_tm1637_string(display_buf);
 }
 
-void update_rear_display(char *display_buf) {
-  display_tm1637_string(display_buf);
+#define FRONT_BYTES_PER_PIXEL 3 // NEO_RGB
+#define FRONT_SHOW_COUNTS (front_digit::led_count * FRONT_BYTES_PER_PIXEL * NEOPIXEL_MICROS_PER_BYTE / TIMER1_MICROS_PER_COUNT)
+
+void show_front_digit(Adafruit_NeoPixel *pixels) {
+  // show() loses the Timer1 ticks after the first while interrupts are off; run them here
+  uint8_t before = TCNT1;
+  pixels->show();
+  uint8_t after = TCNT1;
+  uint8_t missed = missed_timer1_ticks(before, after, FRONT_SHOW_COUNTS);
+  if(missed == 0)
+    return;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    for(uint8_t i = 0; i < missed; i++) {
+      countdown_tick();
+    }
+  }
+  g_frame_missed_ticks += missed;
 }
 
-void update_display(struct display_info *display) {
-  char *display_buf;
-  if (display->dirty) {
-    display_buf = display->use_primary_buffer ? 
-      display->primary_buffer : display->transitory_buffer;
+void commit_frame(bool front, bool rear) {
+  uint32_t rear_committed_micros = 0;
 
-    if(display == &g_front_display) {
-      update_front_display(display_buf);
-    } else {
-      update_rear_display(display_buf);
+  if(rear) {
+    commit_tm1637();
+    rear_committed_micros = micros();
+  }
+
+  if(front) {
+    for(int i = 0; i < FRONT_DIGIT_COUNT; i++) {
+      show_front_digit(&g_front_digits[i]);
+    }
+  }
+
+  if(front && rear) {
+    g_frame_skew_micros = micros() - rear_committed_micros;
+    if(g_frame_skew_micros > g_frame_skew_max_micros) {
+      g_frame_skew_max_micros = g_frame_skew_micros;
     }
-    display->dirty = 0;
   }
+  g_frame_count++;
 }
 
-void set_display(struct display_info *display, char* contents) {
-  if(compare_active_display_buffer(display, contents) != 0) {
-    display_dirty(display);
+void update_displays() {
+  bool front = g_front_display.dirty;
+  bool rear = g_rear_display.dirty;
+  if(!front && !rear)
+    return;
+
+  if(front) {
+    stage_front_display(g_front_display.output_buffer);
+    g_front_display.dirty = 0;
   }
-  
-  fill_active_display_buffer(display, contents);
-  update_display(display);
+  if(rear) {
+    stage_rear_display(g_rear_display.output_buffer);
+    g_rear_display.dirty = 0;
+  }
+  commit_frame(front, rear);
+}
+
+void set_display(struct display_info *display, char* contents) {
+  // write the primary layer and push it out to the hardware right now
+  set_display_layer(display, LAYER_PRIMARY, contents, 0);
+  compose_display(display, g_loop_millis);
+  update_displays();
 
   /*
   Serial.print(F("set_display(): "));
@@ -1703,8 +3035,9 @@ void set_led_brightness() {
   default: led_brightness = 255; break;
   }
 
-  g_left_digit.setBrightness(led_brightness);
-  g_right_digit.setBrightness(led_brightness);
+  for(int i = 0; i < FRONT_DIGIT_COUNT; i++) {
+    g_front_digits[i].setBrightness(led_brightness);
+  }
 
   display_dirty(&g_front_display);
   
@@ -1722,7 +3055,7 @@ long g_pixel_hue = 0;
 void color_fade() {
   // called for each pixel update
   g_pixel_hue += 3;
-  g_color.wrgb = g_right_digit.gamma32(g_right_digit.ColorHSV(g_pixel_hue));
+  g_color.wrgb = Adafruit_NeoPixel::gamma32(Adafruit_NeoPixel::ColorHSV(g_pixel_hue));
 }
 
 #define VIOLET 0x009400D3	 // 	148, 0, 211	#
@@ -1736,23 +3069,25 @@ void color_fade() {
 
 #define RAINBOW_DELAY 100
 
-uint32_t g_rainbow_last_frame = 0;
-uint32_t g_rainbow_last_update_millis = 0;
 uint8_t g_rainbow_starting_color_index = 0;
 
+void rainbow_timer() {
+  // TIMER_RAINBOW: move the pixel index along, for as long as we're in rainbow mode
+  if(g_color_mode != COLOR_MODE_RAINBOW) {
+    stop_timer(TIMER_RAINBOW);
+    return;
+  }
+  g_rainbow_starting_color_index++;
+  if (g_rainbow_starting_color_index >= RAINBOW_COLOR_COUNT) {
+    g_rainbow_starting_color_index = 0;
+  }
+}
+
 void rainbow(uint8_t pixel_index) {
   uint8_t color_index = 0;
-  uint32_t current_millis = millis();
-  
-  if(current_millis > g_rainbow_last_update_millis + RAINBOW_DELAY) {
-    // move the pixel index along
-    g_rainbow_starting_color_index++;
-    if (g_rainbow_starting_color_index >= RAINBOW_COLOR_COUNT) {
-      g_rainbow_starting_color_index = 0;
-    }
 
-    // make sure the display refresh is adequate to maintain the animation
-    g_rainbow_last_update_millis = current_millis;
+  if(!is_timer_armed(TIMER_RAINBOW)) {
+    start_timer(TIMER_RAINBOW, RAINBOW_DELAY, RAINBOW_DELAY);
   }
 
   color_index = (pixel_index + g_rainbow_starting_color_index) % RAINBOW_COLOR_COUNT;
@@ -30,7 +30,10 @@
 #define HELP_STRINGS 1
 
 #include "command-processor.h"
+#include "radio-packet.h"
 #include "shot-clock.h"
+#include "remote-clock.h"
+#include "link-watch.h"
 #include "shot-clock-commands.h"
 
 extern char output_buf[];
@@ -38,9 +41,10 @@ extern uint8_t g_state;
 extern int32_t g_clock_millis;
 extern int32_t g_custom_reset_millis;
 extern bool g_clock_is_running;
-extern bool g_horn_is_on;
+extern volatile bool g_horn_is_on;
 
-extern int32_t g_horn_timer_millis;
+extern volatile uint32_t g_horn_duration_micros;
+extern volatile uint16_t g_horn_scheduled_millis;
 extern uint32_t g_uptime_seconds;
 extern uint8_t g_horn_tenths;
 extern int8_t g_brightness;
@@ -54,16 +58,69 @@ extern uint8_t g_color_mode;
 extern uint8_t g_inputs;
 extern uint8_t g_button_pressed_events;
 extern uint8_t g_button_released_events;
-
-extern bool g_remote_clock_is_running;
+extern struct input_event g_input_history[INPUT_HISTORY_LENGTH];
+extern uint16_t g_input_queue_overflows;
+extern int8_t g_debounce_millis;
+extern volatile uint16_t g_raw_input_edges;
+extern uint32_t g_start_stop_reaction_micros;
+
+extern uint32_t g_frame_count;
+extern uint32_t g_frame_skew_micros;
+extern uint32_t g_frame_skew_max_micros;
+extern uint32_t g_frame_missed_ticks;
+extern uint32_t g_rear_commit_count;
+extern uint16_t g_rear_commit_micros;
+extern uint16_t g_rear_commit_max_micros;
+extern uint16_t g_rear_commit_overruns;
+extern int8_t g_rear_hundredths;
+
+extern uint32_t g_zero_to_stop_micros;
+extern int8_t g_idle_sleep;
+extern struct sleep_stats g_sleep_stats[2];
+extern struct loop_stats g_loop_stats;
+extern int16_t g_loop_budget_micros;
+#if LOOP_TIMING
+extern struct timing_span g_timing_last[TIMING_SPAN_COUNT];
+extern uint32_t g_timing_last_window_micros;
+#endif
+
+extern int16_t g_clock_ppm;
+extern int8_t g_clock_cal_celsius;
+extern int8_t g_clock_tempco;
+extern volatile uint32_t g_tick_q24;
+
+extern struct remote_clock g_remote_clock;
+extern uint32_t g_sync_rtt_micros;
+extern uint32_t g_sync_min_rtt_micros;
+extern uint32_t g_sync_delay_micros;
+extern int32_t g_sync_offset_micros;
+extern uint32_t g_sync_jitter_micros;
+extern uint16_t g_sync_samples;
+extern uint32_t g_sync_age_micros;
+extern uint32_t g_sync_age_jitter_micros;
+extern struct radio_tx_stats g_radio_tx_stats;
+extern uint8_t g_radio_tx_pending;
 extern uint8_t g_radio_signal_strength;
+extern int8_t g_radio_multicast;
+extern int8_t g_radio_listener_id;
+extern int8_t g_radio_poll_listeners;
+extern struct radio_rx_stats g_radio_rx_stats;
+extern struct listener_health g_listener_health[RADIO_MAX_LISTENERS];
+extern struct listener_status g_listener_status[RADIO_MAX_LISTENERS + 1];
+extern struct link_stats g_link_stats;
+extern int16_t g_link_loss_millis;
+extern struct link_watch g_link_watch;
+extern struct radio_power g_radio_power;
+extern uint8_t g_scan_state;
+extern uint8_t g_scan_hits[MAX_RADIO_CHANNEL + 1];
+extern bool g_scan_done;
 
 extern bool g_debug;
 
 /* The first two characters of the message display on the front display (LEDs) of the clock,
    the last four on the rear display (TM1637) */
 
-const char g_messages[][6] =
+const char g_messages[][MESSAGE_CHARS] =
   {
    {MAJOR_VERSION, MINOR_VERSION, ' ', MAJOR_VERSION, '.', MINOR_VERSION},  // MESSAGE_VERSION
    {'H', 'i', 'H', 'E', 'L', 'O'}, // MESSAGE_HELLO
@@ -103,7 +160,7 @@ COMMAND_STRINGS(show_number_transitory, "shows", "(n -- ) put n in transitory di
 COMMAND_STRINGS(show_front, "showf", "(left right -- ) show the two ascii digits from the stack on the front display");
 COMMAND_STRINGS(show_front_transitory, "showfs", "(left right -- ) put chars in transitory display buffer and show for 1 second");
 COMMAND_STRINGS(show_rear, "showr", "(c0 c1 c2 c3 -- ) show the four ascii digits from the stack on the rear display");
-COMMAND_STRINGS(show_rear_transitory, "showrs", "(left right -- ) put chars in transitory display buffer and show for 1 second");
+COMMAND_STRINGS(show_rear_transitory, "showrs", "(c0 c1 c2 c3 -- ) put chars in transitory display buffer and show for 1 second");
 COMMAND_STRINGS(show_time, "update", "update clock time on the LED display");
 COMMAND_STRINGS(increase_time, "time+", "increase clock time by 1 second");
 COMMAND_STRINGS(decrease_time, "time-", "decrease clock time by 1 second");
@@ -130,14 +187,30 @@ COMMAND_STRINGS(color_mode_get, "colormode?", "( -- mode) Put the current color
 COMMAND_STRINGS(color_mode_set, "colormode!", "(mode -- ) Set the current color mode (mode=0-5)"); 
 COMMAND_STRINGS(state, "state", "print the current state of the clock");
 COMMAND_STRINGS(inputs, "inputs", "print the inputs and transitions");
+COMMAND_STRINGS(frame, "frame", "print display frame count and front/rear commit skew, and reset the max");
+COMMAND_STRINGS(sleep, "sleep", "print wakeups, event latency and time asleep, stopped and running, and reset them");
+COMMAND_STRINGS(looptime, "looptime", "print the loop() pass time histogram, the slowest pass and its state, and budget misses");
+COMMAND_STRINGS(looptime_reset, "looptime-reset", "reset the loop() timing");
+COMMAND_STRINGS(timing, "timing", "print where loop() time went in the last timing window");
+COMMAND_STRINGS(calibrate_start, "calstart", "start a clock calibration run against a reference clock");
+COMMAND_STRINGS(calibrate_reference, "calref", "(d -- ) reference clock millis now; two or more give a ppm estimate");
+COMMAND_STRINGS(calibrate_save, "calsave", "save the calibration estimate at the current temperature");
 COMMAND_STRINGS(radio_off, "roff", "turn off radio");
 COMMAND_STRINGS(radio_broadcast, "broadcast", "broadcast current clock time and state on current channel");
 COMMAND_STRINGS(radio_listen, "listen", "listen for radio broadcasts on current channel and update display");
 COMMAND_STRINGS(radio_signal_test, "signal", "signal strength test: send 99 packets");
+COMMAND_STRINGS(sync, "sync", "print radio time sync: round trip, delay, offset, jitter and transmit counts (broadcast), or clock age, error, receive counts and display latency (listen)");
+COMMAND_STRINGS(listeners, "listeners", "print polls and answers for each listener id the broadcaster polls");
+COMMAND_STRINGS(telemetry, "telemetry", "print the last status each listener sent back in its ACKs");
+COMMAND_STRINGS(link, "link", "print link quality: loss and retransmits (broadcast), signal strength (listen), and the last channel scan");
+COMMAND_STRINGS(scan, "scan", "scan the 16 channels for interference, in the background");
+COMMAND_STRINGS(channel_switch, "chanswitch", "(n -- ) move this clock, and a broadcaster's listeners, to channel n");
+COMMAND_STRINGS(channel_best, "chanbest", "chanswitch to the quietest channel in the last scan");
+COMMAND_STRINGS(power, "power", "print transmit power level and steps, the level saved for each channel, and transmit energy");
 COMMAND_STRINGS(radio, "radio", "show radio parameters and update physical radio with them");
 
 
-VARIABLE_STRINGS(clock, "clock", "millis on the clock (double)");
+VARIABLE_STRINGS(clock, "clock", "millis on the clock (double); set it while stopped");
 // expands to
 // const char variable_name_clock[] PROGMEM = "clock"; 
 // const char variable_help_clock[] PROGMEM = "millis on the clock (double)";
@@ -145,6 +218,16 @@ VARIABLE_STRINGS(horntenths, "horntenths", "duration the horn should sound, in t
 VARIABLE_STRINGS(brightness, "brightness", "brightness of the leds, 1-5 (byte)"); 
 VARIABLE_STRINGS(radio_mode, "radiomode", "current radio mode: 0 (off), 1 (broadcast), 2 (listen)");
 VARIABLE_STRINGS(radio_channel, "radiochannel", "current radio channel (0-15)");
+VARIABLE_STRINGS(multicast, "multicast", "broadcast to any number of listeners, without ACKs: 0 (off), 1 (on)");
+VARIABLE_STRINGS(listenerid, "listenerid", "listener id answering polls, 1-3, or 0 for none; apply with radio");
+VARIABLE_STRINGS(polllisteners, "polllisteners", "listener ids 1-n the broadcaster polls, 0 for none");
+VARIABLE_STRINGS(linkloss, "linkloss", "millis of silence before a listener shows the link lost");
+VARIABLE_STRINGS(hundredths, "hundredths", "show hundredths on the rear under 10 seconds: 0 (off), 1 (on)");
+VARIABLE_STRINGS(idlesleep, "idlesleep", "sleep between events: 0 (spin), 1 (idle sleep)");
+VARIABLE_STRINGS(loopbudget, "loopbudget", "loop() pass budget in us, 0 to count no misses (single)");
+VARIABLE_STRINGS(debounce, "debounce", "button sample interval in ms; stable after 4 samples (byte)");
+VARIABLE_STRINGS(clockppm, "clockppm", "ppm the clock runs fast at the calibration temperature (single)");
+VARIABLE_STRINGS(clocktempco, "clocktempco", "clock drift in ppm per degree celsius, 0 for none (byte)");
 
 
 const struct dictionary_entry g_shot_clock_dictionary[] PROGMEM =
@@ -185,10 +268,26 @@ const struct dictionary_entry g_shot_clock_dictionary[] PROGMEM =
    DICT_COMMAND_ENTRY(color_mode_set),
    DICT_COMMAND_ENTRY(state),
    DICT_COMMAND_ENTRY(inputs),
+   DICT_COMMAND_ENTRY(frame),
+   DICT_COMMAND_ENTRY(sleep),
+   DICT_COMMAND_ENTRY(looptime),
+   DICT_COMMAND_ENTRY(looptime_reset),
+   DICT_COMMAND_ENTRY(timing),
+   DICT_COMMAND_ENTRY(calibrate_start),
+   DICT_COMMAND_ENTRY(calibrate_reference),
+   DICT_COMMAND_ENTRY(calibrate_save),
    DICT_COMMAND_ENTRY(radio_off),
    DICT_COMMAND_ENTRY(radio_broadcast),
    DICT_COMMAND_ENTRY(radio_listen),
    DICT_COMMAND_ENTRY(radio_signal_test),
+   DICT_COMMAND_ENTRY(sync),
+   DICT_COMMAND_ENTRY(listeners),
+   DICT_COMMAND_ENTRY(telemetry),
+   DICT_COMMAND_ENTRY(link),
+   DICT_COMMAND_ENTRY(scan),
+   DICT_COMMAND_ENTRY(channel_switch),
+   DICT_COMMAND_ENTRY(channel_best),
+   DICT_COMMAND_ENTRY(power),
    DICT_COMMAND_ENTRY(radio),
    DICT_DOUBLE_VARIABLE_ENTRY(clock, g_clock_millis),
    // above expands to
@@ -197,6 +296,16 @@ const struct dictionary_entry g_shot_clock_dictionary[] PROGMEM =
    DICT_CHAR_VARIABLE_ENTRY(brightness, g_brightness),
    DICT_CHAR_VARIABLE_ENTRY(radio_mode, g_radio_mode),
    DICT_CHAR_VARIABLE_ENTRY(radio_channel, g_radio_channel),
+   DICT_CHAR_VARIABLE_ENTRY(multicast, g_radio_multicast),
+   DICT_CHAR_VARIABLE_ENTRY(listenerid, g_radio_listener_id),
+   DICT_CHAR_VARIABLE_ENTRY(polllisteners, g_radio_poll_listeners),
+   DICT_VARIABLE_ENTRY(linkloss, g_link_loss_millis),
+   DICT_CHAR_VARIABLE_ENTRY(hundredths, g_rear_hundredths),
+   DICT_CHAR_VARIABLE_ENTRY(idlesleep, g_idle_sleep),
+   DICT_VARIABLE_ENTRY(loopbudget, g_loop_budget_micros),
+   DICT_CHAR_VARIABLE_ENTRY(debounce, g_debounce_millis),
+   DICT_VARIABLE_ENTRY(clockppm, g_clock_ppm),
+   DICT_CHAR_VARIABLE_ENTRY(clocktempco, g_clock_tempco),
    {NULL, TYPE_END_OF_DICT, NULL} // end-of-dictionary sentinel
   };
 
@@ -238,13 +347,39 @@ const struct help_entry g_shot_clock_help[] PROGMEM =
    HELP_COMMAND_ENTRY(color_mode_set),
    HELP_COMMAND_ENTRY(state),
    HELP_COMMAND_ENTRY(inputs),
+   HELP_COMMAND_ENTRY(frame),
+   HELP_COMMAND_ENTRY(sleep),
+   HELP_COMMAND_ENTRY(looptime),
+   HELP_COMMAND_ENTRY(looptime_reset),
+   HELP_COMMAND_ENTRY(timing),
+   HELP_COMMAND_ENTRY(calibrate_start),
+   HELP_COMMAND_ENTRY(calibrate_reference),
+   HELP_COMMAND_ENTRY(calibrate_save),
    HELP_COMMAND_ENTRY(radio_off),
    HELP_COMMAND_ENTRY(radio_broadcast),
    HELP_COMMAND_ENTRY(radio_listen),
    HELP_COMMAND_ENTRY(radio_signal_test),
+   HELP_COMMAND_ENTRY(sync),
+   HELP_COMMAND_ENTRY(listeners),
+   HELP_COMMAND_ENTRY(telemetry),
+   HELP_COMMAND_ENTRY(link),
+   HELP_COMMAND_ENTRY(scan),
+   HELP_COMMAND_ENTRY(channel_switch),
+   HELP_COMMAND_ENTRY(channel_best),
+   HELP_COMMAND_ENTRY(power),
    HELP_COMMAND_ENTRY(radio),
    HELP_VARIABLE_ENTRY(clock),
    HELP_VARIABLE_ENTRY(horntenths),
+   HELP_VARIABLE_ENTRY(hundredths),
+   HELP_VARIABLE_ENTRY(idlesleep),
+   HELP_VARIABLE_ENTRY(loopbudget),
+   HELP_VARIABLE_ENTRY(debounce),
+   HELP_VARIABLE_ENTRY(clockppm),
+   HELP_VARIABLE_ENTRY(clocktempco),
+   HELP_VARIABLE_ENTRY(multicast),
+   HELP_VARIABLE_ENTRY(listenerid),
+   HELP_VARIABLE_ENTRY(polllisteners),
+   HELP_VARIABLE_ENTRY(linkloss),
    {NULL, NULL} // end-of-dictionary sentinel
   };
 
@@ -306,8 +441,8 @@ void command_scan_i2c() {
   Serial.println();
 }
 
-void command_read_temperature() {
-
+int8_t read_temperature_celsius() {
+  // returns whole degrees celsius, or TEMP_NOT_READ if the sensor did not answer
   Wire.beginTransmission(TEMP_SENSOR_I2C_ADDRESS);
 
   Wire.write(0); // request temperature in a byte
@@ -319,34 +454,163 @@ void command_read_temperature() {
   // Serial.println(F("DEBUG: requesting temperature"));
   
   if (Wire.available()) {
-    int16_t celsius = Wire.read();
-    int fahr = round(celsius*9.0/5.0+32.0);
+    return (int8_t)Wire.read();
+  }
+
+  return TEMP_NOT_READ;
+}
+
+int16_t read_temperature() {
+  // returns degrees fahrenheit, or -40 if the sensor did not answer
+  int8_t celsius = read_temperature_celsius();
+
+  // we have to return something to indicate an error
+  if(celsius == TEMP_NOT_READ)
+    return -40;
+
+  // maybe have a celsius/fahr setting some day
+  return round(celsius*9.0/5.0+32.0);
+}
+
+void command_read_temperature() {
+  push_single(read_temperature());
+}
+
+/*
+  Direct display API.  Internal code calls these instead of pushing characters onto the
+  data stack and calling the command_* words, which are only thin wrappers around them.
+  That keeps the hot paths cheap, and keeps them from disturbing whatever the user has
+  left on the data stack.
+*/
+
+void fill_front(char *contents, char left, char right) {
+  // on fronts with more than two digits, the shot clock characters are right-aligned
+  memset(contents, ' ', FRONT_DISPLAY_BUFFER_SIZE);
+  contents[FRONT_DISPLAY_BUFFER_SIZE - 2] = left;
+  contents[FRONT_DISPLAY_BUFFER_SIZE - 1] = right;
+}
+
+void show_front(char left, char right) {
+  char contents[FRONT_DISPLAY_BUFFER_SIZE];
+  fill_front(contents, left, right);
+  set_display_layer(&g_front_display, LAYER_PRIMARY, contents, 0);
+}
+
+void show_rear(const char *contents) {
+  set_display_layer(&g_rear_display, LAYER_PRIMARY, contents, 0);
+}
 
-    // maybe have a celsius/fahr setting some day
-    push_single(fahr);
+void show_overlay(uint8_t layer, uint8_t displays, const char *contents, uint16_t duration_millis) {
+  /* contents is laid out like g_messages: two front characters, then four rear. */
+  if(displays & DISPLAY_FRONT) {
+    char front[FRONT_DISPLAY_BUFFER_SIZE];
+    fill_front(front, contents[0], contents[1]);
+    set_display_layer(&g_front_display, layer, front, duration_millis);
+  }
+  if(displays & DISPLAY_REAR) {
+    set_display_layer(&g_rear_display, layer, &contents[MESSAGE_FRONT_CHARS], duration_millis);
+  }
+}
 
+void show_message(uint8_t message_id, bool transitory) {
+  if(message_id > MESSAGE_MAX) {
+    Serial.print(F("BAD MESSAGE ID: "));
+    Serial.println(message_id);
+    fatal_error(ERROR_BAD_MESSAGE_ID);
+  }
+
+  if(transitory) {
+    show_overlay(LAYER_TRANSITORY, DISPLAY_BOTH, g_messages[message_id], DEFAULT_TRANSITORY_DISPLAY_MILLIS);
+  } else {
+    show_overlay(LAYER_PRIMARY, DISPLAY_BOTH, g_messages[message_id], 0);
+  }
+}
+
+void two_digits(int16_t n, char *left_digit, char *right_digit) {
+  /* The two least significant digits of n, blank padded on the left. */
+  *right_digit = (n % 10) + '0';
+  *left_digit = (n / 10) % 10 + '0';
+  if(n < 10)
+    *left_digit = ' ';
+  if(n < 0)
+    *right_digit = *left_digit = '-';
+}
+
+void show_number(int16_t n, bool transitory) {
+  /* The good thing here is that a leading zero, say on the temp,
+     means we are in the hundreds.  No leading zero means in the singles. */
+  char contents[MESSAGE_CHARS];
+  memset(contents, ' ', MESSAGE_CHARS);
+  two_digits(n, &contents[0], &contents[1]);
+  contents[MESSAGE_CHARS - 2] = contents[0];
+  contents[MESSAGE_CHARS - 1] = contents[1];
+
+  if(transitory) {
+    show_overlay(LAYER_TRANSITORY, DISPLAY_BOTH, contents, DEFAULT_TRANSITORY_DISPLAY_MILLIS);
   } else {
-    // we have to push something to indicate an error
-    push_single(-40);
+    show_overlay(LAYER_PRIMARY, DISPLAY_BOTH, contents, 0);
   }
 }
 
-void pop_into_display_buffer(struct display_info *display) {
-  char *display_buf = display->use_primary_buffer ? 
-    display->primary_buffer : display->transitory_buffer;
+void show_time() {
+
+  // 30000 to 29001 should display 30
+  // 29000 to 28001 should display 29
+  // ..
+  // 2000 to 1001 should display 2
+  // 1000 to 1 would display 1
+  // but
+  // 1000 to 901 should display 1
+  // 900 to 801 should display .9
+  // ..
+  // 200 to 101 should display .2
+  // 100 to 1 should display .1
+  // 0 should display 0
+  //
+  // With hundredths on, the rear instead shows 9990 to 9981 as 9:99, down to
+  // 10 to 1 as 0:01, rounding up the same way.
+
+  char display_time[10];
+
+  /*
+    sprintf_P(s, PSTR("%ld "), g_clock_millis);
+    Serial.print(F("display_clock_time(): g_clock_millis="));
+    Serial.println(s);
+  */
+
+  if (g_clock_millis > 900) {
+    sprintf_P(display_time, PSTR("  %2d"), ((g_clock_millis - 1) / 1000) + 1); 
+  } else if (g_clock_millis > 0) {
+    sprintf_P(display_time, PSTR("  .%1d"), ((g_clock_millis - 1) / 100) + 1); 
+  } else {
+    sprintf_P(display_time, PSTR("   0"));
+  }
+
+  // these only recompose the displays if the time shown has changed
+  show_front(display_time[2], display_time[3]);
 
-  for (int i=display->buffer_size - 1; i>=0; i--) {
-    display_buf[i] = pop_single();
+  if(g_rear_hundredths && (g_clock_millis > 0) && (g_clock_millis <= HUNDREDTHS_MAX_MILLIS)) {
+    int16_t hundredths = ((g_clock_millis - 1) / 10) + 1;
+    sprintf_P(display_time, PSTR(" %1d%02d"), hundredths / 100, hundredths % 100);
+    display_time[1] |= REAR_COLON; // the colon goes with this content, not whatever is shown next
   }
-  display->dirty = 1;
+  show_rear(display_time);
+
+  send_radio_command_show_time_if_necessary();
 }
 
 void command_show_front() {
-  pop_into_display_buffer(&g_front_display);
+  char right = pop_single();
+  char left = pop_single();
+  show_front(left, right);
 }      
 
 void command_show_rear() {
-  pop_into_display_buffer(&g_rear_display);
+  char contents[REAR_DISPLAY_BUFFER_SIZE];
+  for (int i=REAR_DISPLAY_BUFFER_SIZE - 1; i>=0; i--) {
+    contents[i] = pop_single();
+  }
+  show_rear(contents);
 }
 
 void command_push_message_characters() {
@@ -357,7 +621,7 @@ void command_push_message_characters() {
     fatal_error(ERROR_BAD_MESSAGE_ID);
   }
   
-  for(int i = 0; i < 6; i++) {
+  for(int i = 0; i < MESSAGE_CHARS; i++) {
     push_single(g_messages[message_id][i]);
   }
 }
@@ -383,152 +647,78 @@ void command_print_message() {
 }
 
 void command_show_message() {
-  //Serial.print(F("command_show_message(): "));
-  //command_dup();
-  //command_print_message();
-  
-  command_push_message_characters();
-  command_show_rear();
-  command_show_front();
+  show_message(pop_single(), false);
 }
 
 void command_show_message_transitory() {
-  //Serial.print(F("command_show_message_transitory(): "));
-  //command_dup();
-  //command_print_message();
-
-  command_push_message_characters();
-  command_show_rear_transitory();
-  command_show_front_transitory();
+  show_message(pop_single(), true);
 }
 
 void command_show_number_transitory() {
-  switch_to_transitory_buffer();
-  command_show_number();
+  show_number(pop_single(), true);
 }
 
 void command_show_front_transitory() {
-  switch_to_transitory_buffer();
-  command_show_front();
+  char contents[MESSAGE_CHARS];
+  contents[1] = pop_single();
+  contents[0] = pop_single();
+  show_overlay(LAYER_TRANSITORY, DISPLAY_FRONT, contents, DEFAULT_TRANSITORY_DISPLAY_MILLIS);
 }      
 
 void command_show_rear_transitory() {
-  switch_to_transitory_buffer();
-  command_show_rear();
+  char contents[MESSAGE_CHARS];
+  for (int i=MESSAGE_CHARS - 1; i>=MESSAGE_FRONT_CHARS; i--) {
+    contents[i] = pop_single();
+  }
+  show_overlay(LAYER_TRANSITORY, DISPLAY_REAR, contents, DEFAULT_TRANSITORY_DISPLAY_MILLIS);
 }      
 
 void command_two_digits() {
   /* Pop a single number from the stack, push the two least significant digits back on the stack, separately. */
-  int16_t n = pop_single();
-
-  char right_digit = (n % 10) + '0';
-  char left_digit = (n / 10) % 10 + '0';
-  if(n < 10)
-    left_digit = ' ';
-  if(n < 0)
-    right_digit = left_digit = '-';
-    
+  char left_digit, right_digit;
+  two_digits(pop_single(), &left_digit, &right_digit);
   push_single(left_digit);
   push_single(right_digit);
 }
 
 void command_show_number() {
-  /* The good thing here is that a leading zero, say on the temp,
-     means we are in the hundreds.  No leading zero means in the singles. */
-  command_two_digits();
-  int16_t n0 = pop_single();
-  int16_t n1 = pop_single();
-  push_single(n1);
-  push_single(n0);
-  command_show_front();
-  push_single(' ');
-  push_single(' ');
-  push_single(n1);
-  push_single(n0);
-  command_show_rear();
+  show_number(pop_single(), false);
 }
 
 void command_show_time() {
-
-  // 30000 to 29001 should display 30
-  // 29000 to 28001 should display 29
-  // ..
-  // 2000 to 1001 should display 2
-  // 1000 to 1 would display 1
-  // but
-  // 1000 to 901 should display 1
-  // 900 to 801 should display .9
-  // ..
-  // 200 to 101 should display .2
-  // 100 to 1 should display .1
-  // 0 should display 0
-
-  char display_time[10];
-
-  /*
-    sprintf_P(s, PSTR("%ld "), g_clock_millis);
-    Serial.print(F("display_clock_time(): g_clock_millis="));
-    Serial.println(s);
-  */
-
-  if (g_clock_millis > 900) {
-    sprintf_P(display_time, PSTR("  %2d"), ((g_clock_millis - 1) / 1000) + 1); 
-  } else if (g_clock_millis > 0) {
-    sprintf_P(display_time, PSTR("  .%1d"), ((g_clock_millis - 1) / 100) + 1); 
-  } else {
-    sprintf_P(display_time, PSTR("   0"));
-  }
-
-  if(compare_active_display_buffer(&g_front_display, &display_time[2]) != 0) {
-    push_single(display_time[2]);
-    push_single(display_time[3]);
-    command_show_front();
-  }
-
-  if(compare_active_display_buffer(&g_rear_display, display_time) != 0) {
-    push_single(display_time[0]);
-    push_single(display_time[1]);
-    push_single(display_time[2]);
-    push_single(display_time[3]);
-    command_show_rear();
-  }
-
-  send_radio_command_show_time_if_necessary();
+  show_time();
 }
 
 void command_set_clock() {
   int16_t seconds = pop_single();
   uint8_t short_seconds = seconds;
   wrap_range(&short_seconds, 0, 99);
-  g_clock_millis = ((uint32_t)short_seconds) * 1000L;
-  command_show_time();
+  set_clock_millis(((uint32_t)short_seconds) * 1000L);
+  show_time();
 }
 
 void command_increase_time() {
   /* increase current time, max is 99 seconds */
-  g_clock_millis = min(g_clock_millis + 1000, 99000);
-  command_show_time();
+  set_clock_millis(min(g_clock_millis + 1000, 99000));
+  show_time();
 }
 
 void command_decrease_time() {
   /* decrease current time, min is 0 */
-  g_clock_millis = g_clock_millis - 1000;
-  if(g_clock_millis < 0) {
-    g_clock_millis = 0;
-  }
-  command_show_time();
+  set_clock_millis(max(g_clock_millis - 1000, 0));
+  show_time();
 }
 
 void command_reset_30() {
-  g_clock_millis = 30000;
-  command_show_time();
+  set_clock_millis(30000);
+  show_time();
   Serial.print(F("Reset clock millis to "));
   Serial.println(g_clock_millis);
 }
 
 void command_reset_custom() {
-  g_clock_millis = g_custom_reset_millis;
-  command_show_time();
+  set_clock_millis(g_custom_reset_millis);
+  show_time();
   Serial.print(F("Custom reset clock millis to "));
   Serial.println(g_clock_millis);
 }
@@ -563,17 +753,13 @@ void command_stop_clock() {
 }
 
 void command_horn() {
-  int16_t tenths = pop_single();
-  g_horn_timer_millis = tenths * 100;
-  digitalWrite(PIN_HORN_RELAY, HIGH);
-  g_horn_is_on = true;
+  horn(pop_single());
 }
 
 void command_beep() {
   // don't activate the relay if we don't need to - it clicks
   if(g_horn_tenths > 0) {
-    push_single(g_horn_tenths);
-    command_horn();
+    horn(g_horn_tenths);
   }
   send_radio_command(RADIO_COMMAND_BEEP);
 }
@@ -747,14 +933,21 @@ void print_display_buffers(struct display_info *display) {
   int i;
   Serial.print(F("["));
   for(i = 0; i < display->buffer_size; i++) {
-    Serial.print((char)display->primary_buffer[i]);
+    Serial.print((char)(display->output_buffer[i] & ~REAR_COLON));
   }
+  Serial.print(F("]"));
 
-  Serial.print(F("] ["));
-  for(i = 0; i < display->buffer_size; i++) {
-    Serial.print((char)display->transitory_buffer[i]);
+  for(int layer = 0; layer < DISPLAY_LAYER_COUNT; layer++) {
+    struct display_layer *l = &display->layers[layer];
+    Serial.print(l->active ? F(" [") : F(" ("));
+    for(i = 0; i < display->buffer_size; i++) {
+      Serial.print((char)(l->buffer[i] & ~REAR_COLON));
+    }
+    Serial.print(l->active ? F("]") : F(")"));
+    if(l->active && l->expires) {
+      Serial.print((int32_t)(l->expires_millis - g_loop_millis));
+    }
   }
-  Serial.print(F("]"));
 }
 
 void command_state() {
@@ -769,23 +962,49 @@ void command_state() {
   sprintf_P(output_buf, PSTR("Clock millis: %d "), g_clock_millis);
   Serial.println(output_buf);
 
-  Serial.print(F("Front buffers (primary, transitory): "));
+  Serial.print(F("Last horn (ms scheduled, us measured): "));
+  Serial.print(g_horn_scheduled_millis);
+  Serial.print(F(" "));
+  Serial.println(g_horn_duration_micros);
+
+  Serial.print(F("Zero to stopped state (us): "));
+  Serial.println(g_zero_to_stop_micros);
+
+  if(g_radio_mode == RADIO_MODE_LISTEN) {
+    Serial.print(F("Remote clock (ms, running, slew left, last error, corrections, snaps): "));
+    Serial.print(g_remote_clock.millis);
+    Serial.print(F(" "));
+    Serial.print(g_remote_clock.running);
+    Serial.print(F(" "));
+    Serial.print(g_remote_clock.slew_millis);
+    Serial.print(F(" "));
+    Serial.print(g_remote_clock.last_error_millis);
+    Serial.print(F(" "));
+    Serial.print(g_remote_clock.corrections);
+    Serial.print(F(" "));
+    Serial.println(g_remote_clock.snaps);
+  }
+
+  Serial.print(F("Clock correction (ppm at C, ppm/C, tick q24): "));
+  Serial.print(g_clock_ppm);
+  Serial.print(F(" "));
+  Serial.print(g_clock_cal_celsius);
+  Serial.print(F(" "));
+  Serial.print(g_clock_tempco);
+  Serial.print(F(" "));
+  Serial.println(g_tick_q24);
+
+  Serial.print(F("Front output, layers (primary, transitory, status): "));
   print_display_buffers(&g_front_display);
   Serial.println();
 
-  Serial.print(F("Rear buffers (primary, transitory): "));
+  Serial.print(F("Rear output, layers (primary, transitory, status): "));
   print_display_buffers(&g_rear_display);
   Serial.println();
   
-  sprintf_P(output_buf, PSTR("Use primary buffer: %d"), g_front_display.use_primary_buffer);
-  Serial.println(output_buf);
-
   sprintf_P(output_buf, PSTR("Dirty: %d"), g_front_display.dirty);
   Serial.println(output_buf);
 
-  sprintf_P(output_buf, PSTR("Millis until primary switch: %d"), g_front_display.transitory_timer_millis);
-  Serial.println(output_buf);
-
   Serial.print(F("Brightness: "));
   Serial.print(g_brightness);
 
@@ -814,6 +1033,435 @@ void command_inputs() {
   Serial.print(output_buf);
   print_buttons(g_button_released_events);
   Serial.println();
+
+  Serial.print(F("Start/stop edge to clock (us): "));
+  Serial.println(g_start_stop_reaction_micros);
+  Serial.print(F("Input queue overflows: "));
+  Serial.println(g_input_queue_overflows);
+  Serial.print(F("Raw pin changes (bounces and all): "));
+  Serial.println(g_raw_input_edges);
+
+  Serial.println(F("Input history (us ago, levels, changed):"));
+  uint32_t now = micros();
+  for(uint8_t i = 0; i < INPUT_HISTORY_LENGTH; i++) {
+    struct input_event *e = &g_input_history[i];
+    if(e->changed == 0)
+      continue; // not filled yet
+    Serial.print(now - e->micros);
+    sprintf_P(output_buf, PSTR(" " BYTE_TO_BINARY_PATTERN), BYTE_TO_BINARY_REVERSE(e->level));
+    Serial.print(output_buf);
+    print_buttons(e->changed);
+    Serial.println();
+  }
+}
+
+void command_frame() {
+  Serial.print(F("Frames: "));
+  Serial.println(g_frame_count);
+  Serial.print(F("Front/rear skew (us): last="));
+  Serial.print(g_frame_skew_micros);
+  Serial.print(F(" max="));
+  Serial.println(g_frame_skew_max_micros);
+  Serial.print(F("Timer ticks replayed after front shows: "));
+  Serial.println(g_frame_missed_ticks);
+  Serial.print(F("Rear commits: "));
+  Serial.print(g_rear_commit_count);
+  Serial.print(F(" time (us): last="));
+  Serial.print(g_rear_commit_micros);
+  Serial.print(F(" max="));
+  Serial.print(g_rear_commit_max_micros);
+  Serial.print(F(" over budget: "));
+  Serial.println(g_rear_commit_overruns);
+  g_frame_skew_max_micros = 0;
+  g_rear_commit_max_micros = 0;
+}
+
+void print_sleep_stats(const __FlashStringHelper *name, struct sleep_stats *stats) {
+  uint32_t total_micros = stats->asleep_micros + stats->awake_micros;
+
+  Serial.print(name);
+  Serial.print(F(": wakeups="));
+  Serial.print(stats->wakeups);
+  Serial.print(F(" latency (us): last="));
+  Serial.print(stats->latency_micros);
+  Serial.print(F(" max="));
+  Serial.print(stats->latency_max_micros);
+  Serial.print(F(" asleep (%): "));
+  Serial.println(total_micros >= 100 ? (stats->asleep_micros / (total_micros / 100)) : 0);
+}
+
+void command_sleep() {
+  // Time asleep is the stand-in for current draw; idle sleep stops the CPU clock but
+  // leaves the LEDs, radio and peripherals drawing what they always do.
+  print_sleep_stats(F("Stopped"), &g_sleep_stats[SLEEP_STATS_STOPPED]);
+  print_sleep_stats(F("Running"), &g_sleep_stats[SLEEP_STATS_RUNNING]);
+  reset_sleep_stats();
+}
+
+void command_looptime() {
+  Serial.print(F("Passes: "));
+  Serial.print(g_loop_stats.passes);
+  Serial.print(F(" max (us): "));
+  Serial.print(g_loop_stats.max_micros);
+  Serial.print(F(" in state "));
+  Serial.println(g_loop_stats.max_state);
+  Serial.print(F("Over budget of "));
+  Serial.print(g_loop_budget_micros);
+  Serial.print(F(" us: "));
+  Serial.println(g_loop_stats.deadline_misses);
+
+  for(uint8_t i = 0; i < LOOP_HISTOGRAM_BUCKETS; i++) {
+    if(g_loop_stats.histogram[i] == 0)
+      continue;
+    // bucket 0 also holds the 0 us passes
+    sprintf_P(output_buf, PSTR("%6lu us+: %u"), i == 0 ? 0UL : 1UL << i, g_loop_stats.histogram[i]);
+    Serial.println(output_buf);
+  }
+}
+
+void command_looptime_reset() {
+  reset_loop_stats();
+}
+
+#if LOOP_TIMING
+// in TIMING_* order
+const char timing_name_input[] PROGMEM = "input";
+const char timing_name_state[] PROGMEM = "state";
+const char timing_name_display_front[] PROGMEM = "front";
+const char timing_name_display_rear[] PROGMEM = "rear";
+const char timing_name_display_commit[] PROGMEM = "commit";
+const char timing_name_horn[] PROGMEM = "horn";
+const char timing_name_serial[] PROGMEM = "serial";
+const char timing_name_radio_send[] PROGMEM = " radio tx";
+const char timing_name_radio_receive[] PROGMEM = " radio rx";
+
+const char *const g_timing_names[TIMING_SPAN_COUNT] PROGMEM =
+  {
+   timing_name_input,
+   timing_name_state,
+   timing_name_display_front,
+   timing_name_display_rear,
+   timing_name_display_commit,
+   timing_name_horn,
+   timing_name_serial,
+   timing_name_radio_send,
+   timing_name_radio_receive,
+  };
+#endif
+
+void command_timing() {
+#if LOOP_TIMING
+  if(g_timing_last_window_micros == 0) {
+    Serial.println(F("No full timing window yet."));
+    return;
+  }
+
+  Serial.print(F("Window (ms): "));
+  Serial.println(g_timing_last_window_micros / 1000);
+  Serial.println(F("span          total us  count  avg us  max us  %"));
+  for(uint8_t i = 0; i < TIMING_SPAN_COUNT; i++) {
+    struct timing_span *t = &g_timing_last[i];
+    char name[12];
+    strncpy_P(name, (const char *)pgm_read_ptr(&g_timing_names[i]), sizeof(name));
+    name[sizeof(name) - 1] = '\0';
+    // radio spans are indented: they are also counted in state
+    sprintf_P(output_buf, PSTR("%-12s %9lu %6u %7lu %7u %2lu"), name, t->micros, t->count,
+	      t->count ? t->micros / t->count : 0UL, t->max_micros,
+	      t->micros / (g_timing_last_window_micros / 100));
+    Serial.println(output_buf);
+  }
+#else
+  Serial.println(F("Loop timing is compiled out (LOOP_TIMING 0)."));
+#endif
+}
+
+void command_calibrate_start() {
+  start_clock_calibration();
+  Serial.println(F("Send calref with the reference millis, minutes apart."));
+}
+
+void command_calibrate_reference() {
+  int16_t ppm;
+
+  add_clock_calibration_reference(pop_double());
+  if(clock_calibration_ppm(&ppm)) {
+    Serial.print(F("Clock runs fast (ppm): "));
+    Serial.println(ppm);
+  }
+}
+
+void command_calibrate_save() {
+  int16_t ppm;
+
+  if(!clock_calibration_ppm(&ppm)) {
+    Serial.println(F("No calibration estimate yet."));
+    return;
+  }
+
+  int8_t celsius = read_temperature_celsius();
+  g_clock_ppm = ppm;
+  if(celsius != TEMP_NOT_READ)
+    g_clock_cal_celsius = celsius;
+  update_clock_tick(celsius);
+  save_settings();
+
+  Serial.print(F("Saved "));
+  Serial.print(g_clock_ppm);
+  Serial.print(F(" ppm at "));
+  Serial.print(g_clock_cal_celsius);
+  Serial.println(F(" C"));
+}
+
+void command_sync() {
+  if(g_radio_mode == RADIO_MODE_BROADCAST) {
+    Serial.print(F("Round trip (us): last="));
+    Serial.print(g_sync_rtt_micros);
+    Serial.print(F(" min="));
+    Serial.println(g_sync_min_rtt_micros);
+    Serial.print(F("One-way delay (us): "));
+    Serial.println(g_sync_delay_micros);
+    Serial.print(F("Listener offset (us): "));
+    if(g_sync_offset_micros == SYNC_OFFSET_UNKNOWN) {
+      Serial.println(F("unknown"));
+    } else {
+      Serial.println(g_sync_offset_micros);
+    }
+    Serial.print(F("Jitter (us): "));
+    Serial.print(g_sync_jitter_micros);
+    Serial.print(F(" from "));
+    Serial.print(g_sync_samples);
+    Serial.println(F(" samples"));
+    Serial.print(F("Transmit: commands="));
+    Serial.print(g_radio_tx_stats.queued);
+    Serial.print(F(" batched="));
+    Serial.print(g_radio_tx_stats.batched);
+    Serial.print(F(" packets="));
+    Serial.print(g_radio_tx_stats.packets);
+    Serial.print(F(" delivered="));
+    Serial.print(g_radio_tx_stats.delivered);
+    Serial.print(F(" failed="));
+    Serial.print(g_radio_tx_stats.failed);
+    Serial.print(F(" timed_out="));
+    Serial.print(g_radio_tx_stats.timed_out);
+    Serial.print(F(" pending="));
+    Serial.println(g_radio_tx_pending, BIN);
+    Serial.print(F("Longest attempt (us): "));
+    Serial.println(g_radio_tx_stats.airtime_max_micros);
+  } else if(g_radio_mode == RADIO_MODE_LISTEN) {
+    // the clock correction error is how far apart the two clocks were
+    Serial.print(F("Clock age when read (us): "));
+    Serial.print(g_sync_age_micros);
+    Serial.print(F(" jitter="));
+    Serial.println(g_sync_age_jitter_micros);
+    Serial.print(F("Offset from broadcaster (ms): "));
+    Serial.println(g_remote_clock.last_error_millis);
+    Serial.print(F("Received: packets="));
+    Serial.print(g_radio_rx_stats.packets);
+    Serial.print(F(" duplicates="));
+    Serial.print(g_radio_rx_stats.duplicates);
+    Serial.print(F(" lost="));
+    Serial.print(g_radio_rx_stats.lost);
+    Serial.print(F(" bad="));
+    Serial.print(g_radio_rx_stats.bad);
+    Serial.print(F(" polls="));
+    Serial.println(g_radio_rx_stats.polls);
+    Serial.print(F("Stale times skipped: "));
+    Serial.print(g_radio_rx_stats.stale);
+    Serial.print(F(", most read in a pass: "));
+    Serial.println(g_radio_rx_stats.drained_max);
+    Serial.print(F("Read to display (us): last="));
+    Serial.print(g_radio_rx_stats.display_micros);
+    Serial.print(F(" max="));
+    Serial.println(g_radio_rx_stats.display_max_micros);
+  } else {
+    print_radio_mode();
+  }
+}
+
+void command_listeners() {
+  if(g_radio_mode != RADIO_MODE_BROADCAST || g_radio_poll_listeners <= 0) {
+    Serial.println(F("Set polllisteners on the broadcaster."));
+    return;
+  }
+  for(int8_t i = 0; i < g_radio_poll_listeners && i < RADIO_MAX_LISTENERS; i++) {
+    struct listener_health *health = &g_listener_health[i];
+    Serial.print(F("Listener "));
+    Serial.print(i + 1);
+    Serial.print(F(": answered "));
+    Serial.print(health->answers);
+    Serial.print(F(" of "));
+    Serial.print(health->polls);
+    if(health->answers > 0) {
+      Serial.print(F(", last "));
+      Serial.print((g_loop_millis - health->last_answer_millis) / 1000);
+      Serial.print(F(" s ago, round trip "));
+      Serial.print(health->rtt_micros);
+      Serial.print(F(" us"));
+    }
+    Serial.println();
+  }
+}
+
+void command_telemetry() {
+  bool any = false;
+  for(uint8_t i = 0; i <= RADIO_MAX_LISTENERS; i++) {
+    struct listener_status *status = &g_listener_status[i];
+    if(status->reports == 0)
+      continue;
+    any = true;
+    struct radio_ack *report = &status->report;
+    Serial.print(F("Listener "));
+    Serial.print(i);
+    Serial.print(F(": took "));
+    Serial.print(report->accepted_serial);
+    Serial.print(F(", shows "));
+    int16_t centis = report->displayed_centis;
+    if(centis < 0) {
+      Serial.print(F("-"));
+      centis = -centis;
+    }
+    Serial.print(centis / 100);
+    Serial.print(F("."));
+    Serial.print((centis / 10) % 10);
+    Serial.print(centis % 10);
+    Serial.print(report->flags & LISTENER_FLAG_RUNNING ? F(" running") : F(" stopped"));
+    Serial.print(F(", loop max "));
+    Serial.print(report->loop_max_micros);
+    Serial.print(F(" us, "));
+    if(report->celsius == TEMP_NOT_READ) {
+      Serial.print(F("no temperature"));
+    } else {
+      Serial.print(report->celsius);
+      Serial.print(F(" C"));
+    }
+    Serial.print(F(", reset cause 0x"));
+    Serial.println(report->reset_cause, HEX);
+    Serial.print(F("  "));
+    Serial.print(status->reports);
+    Serial.print(F(" reports, last "));
+    Serial.print((g_loop_millis - status->received_millis) / 1000);
+    Serial.println(F(" s ago"));
+  }
+  if(!any) {
+    Serial.println(F("No listener has reported."));
+  }
+}
+
+void command_link() {
+  if(g_radio_mode == RADIO_MODE_BROADCAST) {
+    uint8_t lost = 0;
+    for(uint32_t h = g_link_stats.loss_history; h != 0; h &= h - 1) {
+      lost++;
+    }
+    Serial.print(F("Lost "));
+    Serial.print(lost);
+    Serial.print(F(" of the last "));
+    Serial.print(g_link_stats.history_length);
+    Serial.println(F(" packets"));
+    Serial.print(F("Retransmits: last="));
+    Serial.print(g_link_stats.last_retransmits);
+    Serial.print(F(" average="));
+    Serial.print(g_link_stats.retransmits_x16 / 16.0);
+    Serial.print(F(" total="));
+    Serial.println(g_link_stats.retransmits);
+  } else if(g_radio_mode == RADIO_MODE_LISTEN) {
+    Serial.print(F("Packets over -64 dBm: "));
+    Serial.print(g_link_stats.strong);
+    Serial.print(F(" of "));
+    Serial.println(g_link_stats.strong + g_link_stats.weak);
+    Serial.print(g_link_watch.lost ? F("Link lost, last heard ") : F("Link up, last heard "));
+    Serial.print(g_loop_millis - g_link_watch.last_contact_millis);
+    Serial.print(F(" ms ago; lost "));
+    Serial.print(g_link_watch.losses);
+    Serial.println(F(" times"));
+  } else {
+    print_radio_mode();
+  }
+
+  if(g_scan_state != RADIO_SCAN_IDLE) {
+    Serial.println(F("Channel scan running"));
+  } else if(g_scan_done) {
+    Serial.print(F("Busy readings of "));
+    Serial.print(RADIO_SCAN_SAMPLES);
+    Serial.println(F(" by channel:"));
+    for(uint8_t channel = MIN_RADIO_CHANNEL; channel <= MAX_RADIO_CHANNEL; channel++) {
+      Serial.print(channel);
+      Serial.print(F(":"));
+      Serial.print(g_scan_hits[channel]);
+      Serial.print(channel == g_radio_channel ? F("* ") : F(" "));
+    }
+    Serial.println();
+  }
+}
+
+void command_scan() {
+  if(!start_channel_scan()) {
+    Serial.println(F("Can't scan now: radio busy, or the clock is running."));
+  }
+}
+
+void command_channel_switch() {
+  if(!switch_radio_channel(pop_single())) {
+    Serial.println(F("Channel not switched."));
+  }
+}
+
+void command_channel_best() {
+  int8_t channel = quietest_channel();
+  if(channel < 0) {
+    Serial.println(F("Run scan first."));
+    return;
+  }
+  if(!switch_radio_channel(channel)) {
+    Serial.println(F("Channel not switched."));
+  }
+}
+
+void command_power() {
+  static const float milliamps[RADIO_PA_LEVELS] = RADIO_PA_MILLIAMPS;
+  Serial.print(F("PA level "));
+  Serial.print(g_radio_power.level);
+  Serial.print(F(" of "));
+  Serial.print(RADIO_PA_LEVELS - 1);
+  Serial.print(F(", "));
+  Serial.print(g_radio_power.steps_up);
+  Serial.print(F(" steps up, "));
+  Serial.print(g_radio_power.steps_down);
+  Serial.print(F(" down, "));
+  Serial.print(g_radio_power.clean);
+  Serial.println(F(" clean packets"));
+
+  Serial.print(F("Saved by channel:"));
+  for(uint8_t channel = MIN_RADIO_CHANNEL; channel <= MAX_RADIO_CHANNEL; channel++) {
+    uint8_t level = saved_radio_power(channel);
+    Serial.print(F(" "));
+    Serial.print(channel);
+    Serial.print(F(":"));
+    if(level < RADIO_PA_LEVELS) {
+      Serial.print(level);
+    } else {
+      Serial.print(F("-"));
+    }
+  }
+  Serial.println();
+
+  // micros * mA * V is nJ
+  float millijoules = 0;
+  uint32_t airtime_micros = 0;
+  for(uint8_t level = 0; level < RADIO_PA_LEVELS; level++) {
+    airtime_micros += g_radio_power.airtime_micros[level];
+    millijoules += g_radio_power.airtime_micros[level] * milliamps[level] * RADIO_SUPPLY_VOLTS / 1e6;
+  }
+  float full_power_millijoules = airtime_micros * milliamps[RADIO_PA_LEVELS - 1] * RADIO_SUPPLY_VOLTS / 1e6;
+  Serial.print(F("Transmit: "));
+  Serial.print(airtime_micros / 1000);
+  Serial.print(F(" ms, "));
+  Serial.print(millijoules);
+  Serial.print(F(" mJ; "));
+  Serial.print(full_power_millijoules);
+  Serial.print(F(" mJ at full power, over "));
+  Serial.print(g_uptime_seconds);
+  Serial.println(F(" s"));
 }
 
 void command_radio_off() {
@@ -67,6 +67,16 @@
   ((n/100) % 10), \
   (n % 10)
     
+int8_t read_temperature_celsius(void);
+int16_t read_temperature(void);
+void show_front(char left, char right);
+void show_rear(const char *contents);
+void show_overlay(uint8_t layer, uint8_t displays, const char *contents, uint16_t duration_millis);
+void show_message(uint8_t message_id, bool transitory);
+void show_number(int16_t n, bool transitory);
+void show_time(void);
+void two_digits(int16_t n, char *left_digit, char *right_digit);
+
 void command_scan_i2c(void);
 void command_read_temperature(void);
 void command_show_front(void);
@@ -109,6 +119,22 @@ void command_color_mode_get(void);
 void command_color_mode_set(void);
 void command_state(void);
 void command_inputs(void);
+void command_frame(void);
+void command_sleep(void);
+void command_looptime(void);
+void command_looptime_reset(void);
+void command_timing(void);
+void command_calibrate_start(void);
+void command_calibrate_reference(void);
+void command_calibrate_save(void);
+void command_sync(void);
+void command_listeners(void);
+void command_telemetry(void);
+void command_link(void);
+void command_scan(void);
+void command_channel_switch(void);
+void command_channel_best(void);
+void command_power(void);
 void command_radio_off(void);
 void command_radio_broadcast(void);
 void command_radio_listen(void);
@@ -99,8 +99,37 @@
 
 #define INPUT_HISTORY_LENGTH 6 // record last 6 inputs on transition.
 
-#define PIXELS_PER_SEGMENT 7 // 8 for the other clock
-#define LED_COUNT 50
+/*
+  The debouncer in the timer ISR pushes every debounced edge onto a ring, and loop()
+  drains it, so a press and release inside one slow pass still makes a press event.  One
+  producer (the ISR) and one consumer (loop()), so head and tail need no locking.
+*/
+#define INPUT_QUEUE_LENGTH 16 // a power of two
+#define DEFAULT_DEBOUNCE_SAMPLE_MILLIS 2 // stable for DEBOUNCE_SAMPLES samples: 8 ms
+
+struct input_event {
+  uint32_t micros; // when the edge happened
+  uint8_t changed; // INPUT_* bits that changed
+  uint8_t level; // all the INPUT_* levels after the change
+};
+
+/*
+  Clock builds.  The front digit geometry for each build is in digit-geometry.h.  Game
+  clocks with more front digits define FRONT_DIGIT_COUNT and FRONT_DIGIT_PINS (left to
+  right) for their own wiring; shot clock characters are right-aligned on them.
+*/
+#define CLOCK_BUILD_7_PIXEL 0 // 7 pixels per segment
+#define CLOCK_BUILD_8_PIXEL 1 // 8 pixels per segment, the other clock
+
+#ifndef CLOCK_BUILD
+#define CLOCK_BUILD CLOCK_BUILD_7_PIXEL
+#endif
+
+#ifndef FRONT_DIGIT_COUNT
+#define FRONT_DIGIT_COUNT 2
+#define FRONT_DIGIT_PINS {PIN_LEFT_LED_STRING, PIN_RIGHT_LED_STRING}
+#endif
+
 #define DISPLAY_TEMP_MILLIS 1000
 
 /*
@@ -121,11 +150,12 @@ Segments:
   <__D__>
 */
 
-#define SEGMENT_E 0
-#define SEGMENT_D 1
+// same order as the SEG_A..SEG_G bits; the wiring order maps them onto the string
+#define SEGMENT_A 0
+#define SEGMENT_B 1
 #define SEGMENT_C 2
-#define SEGMENT_B 3
-#define SEGMENT_A 4
+#define SEGMENT_D 3
+#define SEGMENT_E 4
 #define SEGMENT_F 5
 #define SEGMENT_G 6
 
@@ -150,6 +180,15 @@ Segments:
 #define EEPROM_HORN_TENTHS 0x01
 #define EEPROM_RADIO_MODE 0x02
 #define EEPROM_RADIO_CHANNEL 0x03
+#define EEPROM_CLOCK_PPM_LOW 0x04 // int16_t clock correction, low byte
+#define EEPROM_CLOCK_PPM_HIGH 0x05
+#define EEPROM_CLOCK_CAL_CELSIUS 0x06
+#define EEPROM_CLOCK_TEMPCO 0x07
+#define EEPROM_RADIO_MULTICAST 0x08
+#define EEPROM_RADIO_LISTENER_ID 0x09
+#define EEPROM_RADIO_POLL_LISTENERS 0x0a
+#define EEPROM_CLOCK_CAL_SAVED 0x0b // CLOCK_CAL_SAVED once the clock settings above were saved
+#define EEPROM_RADIO_PA_LEVELS 0x10 // one per radio channel, through 0x1f
 
 #define DEFAULT_HORN_TENTHS 13
 #define MAX_HORN_TENTHS 30
@@ -161,6 +200,18 @@ Segments:
 #define DEFAULT_TRANSITORY_DISPLAY_MILLIS 1000L
 
 #define TEMP_SENSOR_I2C_ADDRESS 0x48
+#define TEMP_NOT_READ -128
+
+/*
+  Clock calibration.  The resonator runs g_clock_ppm parts per million fast at
+  g_clock_cal_celsius, changing by g_clock_tempco ppm per degree.  The countdown ISR
+  adds the real length of one tick, in Q24 fixed-point milliseconds, to a fraction.
+*/
+#define MAX_CLOCK_PPM 20000
+#define MAX_CLOCK_TEMPCO 100
+#define DEFAULT_CLOCK_CAL_CELSIUS 25
+#define CLOCK_CAL_SAVED 0x5a // blank EEPROM reads 0xff, which is -1 ppm, -1 C and -1 ppm/C
+#define TEMP_COMPENSATION_INTERVAL_MILLIS 60000L
 
 #define COLOR_MODE_NONE       0
 #define COLOR_MODE_WHITE      1
@@ -194,8 +245,9 @@ Segments:
 
 #define RADIO_DELAY                    5  
 #define RADIO_RETRIES                  15
-// If these are two large, then the clock will stutter in broadcast mode if there
-// is no corresponding clock listening, due to all the retries.
+// The transceiver retries on its own (RADIO_DELAY, RADIO_RETRIES); on top of that a
+// command gets MAX_TRANSMISSION_RETRIES more tries, all within MAX_TRANSMISSION_MILLIS.
+// None of it blocks: see service_radio_transmit().
 #define MAX_TRANSMISSION_RETRIES       1
 #define MAX_TRANSMISSION_MILLIS        50
   
@@ -222,14 +274,45 @@ Segments:
 #define ERROR_BAD_MESSAGE_ID 100
 
 #define RADIO_ADDRESS {'S','P','Q','R', 1}
+
+/*
+  Multicast, for one broadcaster and several listeners.  Packets go out without ACKs,
+  RADIO_MULTICAST_COPIES times each, so a listener that misses one copy has the next, and
+  the broadcaster's cost doesn't grow with the number of listeners.  Copies keep the
+  packet's sequence number, and a listener applies a packet's commands only once.  With
+  no ACKs there is no round trip to measure, so listeners get no latency compensation;
+  each copy is stamped afresh, which keeps the error to one packet's airtime.
+
+  A listener with a listener id (1-RADIO_MAX_LISTENERS) also answers polls on its own
+  address: the radio address with the first byte RADIO_POLL_ADDRESS_BYTE(id).  A
+  broadcaster with polllisteners set polls one id every RADIO_POLL_INTERVAL_MILLIS, with
+  an ACK, to see who is there.  Polls carry the last sequence number and no commands.
+*/
+#define RADIO_MULTICAST_COPIES 3
+#define RADIO_MAX_LISTENERS 3
+#define RADIO_POLL_ADDRESS_BYTE(id) ('0' + (id))
+#define RADIO_POLL_PIPE 2
+#define RADIO_POLL_INTERVAL_MILLIS 1000
+
 #define RADIO_COMMAND_SHOW_TIME 1
 #define RADIO_COMMAND_BEEP 2
 #define RADIO_COMMAND_CLOCK_STARTED 3
 #define RADIO_COMMAND_CLOCK_STOPPED 4
 #define RADIO_COMMAND_SIGNAL_TEST 5
-#define MAX_RADIO_COMMAND RADIO_COMMAND_SIGNAL_TEST
+#define RADIO_COMMAND_SWITCH_CHANNEL 6 // to the packet's channel
+#define RADIO_COMMAND_HEARTBEAT 7 // nothing else to say
+#define MAX_RADIO_COMMAND RADIO_COMMAND_HEARTBEAT
 
 #define SEG_DP   0b10000000 // for the TM1637 decimal point segment
+#define REAR_COLON 0x80 // or'd into the second rear character to light the colon with it
+
+// Under 10 seconds the rear can show hundredths as " 9:99".  That means a rear update
+// every 10ms, so the TM1637 is clocked faster than the library default of 100us per
+// bit, only the digits that changed are written, and any commit slower than the
+// budget is counted.
+#define HUNDREDTHS_MAX_MILLIS        9990
+#define TM1637_BIT_DELAY_MICROS      20
+#define REAR_COMMIT_BUDGET_MICROS    2000
 union color {
   uint32_t wrgb;
   struct {
@@ -237,44 +320,335 @@ union color {
   } parts;
 };
 
-#define FRONT_DISPLAY_BUFFER_SIZE 2
+#define FRONT_DISPLAY_BUFFER_SIZE FRONT_DIGIT_COUNT
+#define MESSAGE_FRONT_CHARS 2 // front characters in a message, right-aligned on the display
 #define REAR_DISPLAY_BUFFER_SIZE 4
+#define MESSAGE_CHARS (MESSAGE_FRONT_CHARS + REAR_DISPLAY_BUFFER_SIZE)
+
+/*
+  Each display composes its output from a small fixed pool of layers.  The layer index is
+  its priority: the highest active layer is what gets shown.  The primary layer is always
+  active.  The others are overlays that can be given an expiry, after which the layer
+  underneath shows through again.
+*/
+#define LAYER_PRIMARY    0 // clock time, setting values
+#define LAYER_TRANSITORY 1 // setting names, temperature
+#define LAYER_STATUS     2 // radio status
+#define DISPLAY_LAYER_COUNT 3
+
+#define DISPLAY_FRONT 1
+#define DISPLAY_REAR  2
+#define DISPLAY_BOTH  (DISPLAY_FRONT | DISPLAY_REAR)
+
+/*
+  Events wake loop() from idle sleep.  The ISRs raise them; loop() takes them all at the
+  top of each pass.  Serial and the radio have no event bit: serial input is checked
+  before sleeping (the USART interrupt wakes us), and the radio is polled on the tick.
+*/
+#define EVENT_INPUT     0b00000001 // a button pin changed
+#define EVENT_COUNTDOWN 0b00000010 // the countdown hit zero
+#define EVENT_HORN      0b00000100 // the horn turned off
+#define EVENT_TICK      0b00001000 // g_event_tick_millis have passed
+
+#define EVENT_TICK_MILLIS       10 // running, animating, horn or listening to the radio
+#define IDLE_EVENT_TICK_MILLIS 100 // stopped with nothing moving
+#define LISTEN_EVENT_TICK_MILLIS 2 // following a running remote clock: bounds the radio read lag
+
+#define SLEEP_STATS_STOPPED 0
+#define SLEEP_STATS_RUNNING 1
+
+struct sleep_stats {
+  uint32_t wakeups; // loop passes started by an event
+  uint32_t asleep_micros;
+  uint32_t awake_micros;
+  uint16_t latency_micros; // event raised to loop() running
+  uint16_t latency_max_micros;
+};
+
+/*
+  Loop timing.  Each loop() pass, from waking to the end, lands in a log2 bucket: bucket
+  n counts passes of 2^n to 2^(n+1)-1 us, and the last bucket everything longer.
+*/
+#define LOOP_HISTOGRAM_BUCKETS 16 // the last one is 32768 us and up
+#define DEFAULT_LOOP_BUDGET_MICROS 10000 // one fast event tick
+
+struct loop_stats {
+  uint16_t histogram[LOOP_HISTOGRAM_BUCKETS]; // saturates at 65535
+  uint32_t passes;
+  uint32_t max_micros;
+  uint8_t max_state; // g_state the slowest pass started in
+  uint32_t deadline_misses; // passes over g_loop_budget_micros
+};
+
+/*
+  Per-phase time accounting in loop().  Set LOOP_TIMING to 0 to compile all of it out.
+  Spans add up over a window; at the end of each window it becomes the last window,
+  which is what the timing word prints.
+*/
+#ifndef LOOP_TIMING
+#define LOOP_TIMING 1
+#endif
+
+#define TIMING_INPUT         0
+#define TIMING_STATE         1
+#define TIMING_DISPLAY_FRONT 2
+#define TIMING_DISPLAY_REAR  3
+#define TIMING_DISPLAY_COMMIT 4
+#define TIMING_HORN          5
+#define TIMING_SERIAL        6
+#define TIMING_RADIO_SEND    7
+#define TIMING_RADIO_RECEIVE 8
+#define TIMING_SPAN_COUNT    9
+
+#define TIMING_WINDOW_MILLIS 10000L
+
+struct timing_span {
+  uint32_t micros;
+  uint16_t count;
+  uint16_t max_micros;
+};
+
+#if LOOP_TIMING
+void add_timing(uint8_t span, uint32_t micros);
+
+struct timing_scope {
+  // times the rest of the enclosing block, however it returns
+  uint8_t span;
+  uint32_t start_micros;
+  timing_scope(uint8_t s) : span(s), start_micros(micros()) {}
+  ~timing_scope() { add_timing(span, micros() - start_micros); }
+};
+
+#define TIMING_START(SPAN) uint32_t timing_start_ ## SPAN = micros()
+#define TIMING_END(SPAN) add_timing(SPAN, micros() - timing_start_ ## SPAN)
+#define TIMING_SCOPE(SPAN) struct timing_scope timing_scope_ ## SPAN(SPAN)
+#else
+#define TIMING_START(SPAN)
+#define TIMING_END(SPAN)
+#define TIMING_SCOPE(SPAN)
+#endif
+
+/*
+  Time.  loop() takes one snapshot of millis() at the top of each pass, g_loop_millis, and
+  everything in the pass uses it, so all of them agree on "now".  Code that needs the time
+  afresh, past the snapshot, reads time_source_millis(), from time-source.h, which host
+  builds swap for a simulated clock.  Measurements and the ISRs use micros() directly.
+*/
+
+extern uint32_t g_loop_millis;
+
+/*
+  Software timers.  Everything loop() used to count down or compare every pass is a timer
+  here instead.  run_timers() costs one comparison against the earliest due time until
+  something is actually due, and the earliest due time is there for deciding how long to
+  sleep.  Times are millis(), compared wrap-safe.  Callbacks run from loop(), not an ISR.
+*/
+#define TIMER_STATE             0 // g_state timeouts
+#define TIMER_UPTIME            1
+#define TIMER_FRONT_REFRESH     2
+#define TIMER_REAR_REFRESH      3
+#define TIMER_FRONT_EXPIRY      4 // earliest front overlay expiry
+#define TIMER_REAR_EXPIRY       5
+#define TIMER_RAINBOW           6
+#define TIMER_TEMP_COMPENSATION 7
+#define TIMER_TIMING_WINDOW     8
+#define TIMER_RADIO_POLL        9
+#define TIMER_RADIO_HEARTBEAT   10
+#define TIMER_LINK_LOSS         11 // listener, restarted by every valid packet
+#define TIMER_COUNT             12
+
+struct soft_timer {
+  uint32_t due_millis;
+  uint32_t period_millis; // 0 for one shot
+};
+
+struct display_layer {
+  char *buffer;
+  uint8_t active : 1;
+  uint8_t expires : 1;
+  uint32_t expires_millis;
+};
 
 struct display_info {
-  char *primary_buffer;
-  char *transitory_buffer;
+  char *output_buffer; // composed from the layers; what the hardware shows
+  struct display_layer layers[DISPLAY_LAYER_COUNT];
   unsigned int buffer_size;
-  uint16_t use_primary_buffer : 1;
   uint16_t dirty : 1;
   uint16_t animated : 1;
   uint16_t requires_refresh : 1;
-  int16_t transitory_timer_millis : 12; // timer to switch back to primary
-  int16_t refresh_millis; // timer to refresh display
+  uint16_t layers_changed : 1; // recompose on the next refresh
+  uint8_t refresh_timer; // TIMER_* for the periodic refresh
+  uint8_t expiry_timer; // TIMER_* armed for the earliest layer expiry
+};
+
+/*
+  Radio time sync, NTP style.  The broadcaster stamps send_micros (t1).  The listener notes
+  its micros() when it reads the packet (t2) and loads both into the ACK payload that goes
+  back with the next packet.  The broadcaster knows how long the write carrying t1 took
+  (the round trip, retries and all) and takes the one-way delay as that less the return
+  leg, half the quickest round trip seen.  That gives the offset between the two clocks,
+  which goes out in every packet, so the listener can work out how old each clock_millis
+  is when it reads it: t2 - offset - t1.
+*/
+#define SYNC_OFFSET_UNKNOWN ((int32_t)0x80000000)
+#define MAX_SYNC_AGE_MICROS 50000L // older than any write can take: a bad offset
+#define SYNC_JITTER_SHIFT 4 // jitter is smoothed over 16 samples, as in RFC 3550
+
+struct listener_status {
+  struct radio_ack report; // the last one
+  uint32_t received_millis;
+  uint16_t reports;
+};
+
+/*
+  Radio transmit.  send_radio_command() only marks the command pending.
+  service_radio_transmit() puts every pending command in one packet (radio-packet.h),
+  stamps it and starts it with startFastWrite() when the transceiver is free, then
+  polls the status register on later passes until the ACK, the auto-retries running out or
+  the deadline.  While a packet is in the air wait_for_event() reads the status once a
+  Timer1 tick and sleeps in between, so the round trip is timed to within a millisecond,
+  finer than the 10 ms the clock time goes in.
+*/
+#define RADIO_TX_IDLE    0
+#define RADIO_TX_SENDING 1 // in the air
+#define RADIO_TX_DONE    2 // ACKed or given up on by the transceiver, not yet handled
+
+struct radio_tx_stats {
+  uint16_t queued; // commands
+  uint16_t batched; // commands that shared a packet with another
+  uint16_t packets;
+  uint16_t delivered;
+  uint16_t failed; // every attempt used up
+  uint16_t timed_out; // the transceiver never finished before the deadline
+  uint32_t airtime_max_micros; // longest single attempt, auto-retries and all
+};
+
+#define RADIO_RX_FIFO_DEPTH 3 // most packets one pass reads
+
+struct radio_rx_stats {
+  uint16_t packets; // decoded
+  uint16_t duplicates; // copies or retries of a packet already taken
+  uint16_t lost; // sequence numbers never seen
+  uint16_t bad; // failed to decode, or a time out of range
+  uint16_t polls; // on our own address
+  uint16_t stale; // times a newer packet in the same pass superseded
+  uint8_t drained_max; // most packets read in one pass
+  uint32_t display_micros; // from reading the newest time to the frame showing it
+  uint32_t display_max_micros;
 };
 
-struct radio_message {
-  uint8_t sender_serial_number;
-  uint16_t message_serial_number;
-  uint8_t command;  
-  int32_t clock_millis;
-  uint8_t clock_running;
-  uint8_t checksum;
+/*
+  Link quality.  Every packet that asks for an ACK adds a bit to a loss history of the
+  last 32, and the transceiver's count of auto-retransmits (ARC in OBSERVE_TX) to a
+  smoothed average.  Listeners count packets with the carrier detect (RPD) set, those
+  stronger than -64 dBm.
+
+  A channel scan listens on each of the 16 allowed channels in turn, RADIO_SCAN_SAMPLES
+  times, one reading a pass, and counts how often something was on the air.  A channel
+  switch goes out as a command with the new channel in the packet; the broadcaster
+  follows once the packet is done, retrying up to RADIO_SWITCH_ATTEMPTS times for an ACK.
+*/
+#define RADIO_SCAN_IDLE      0
+#define RADIO_SCAN_LISTENING 1
+#define RADIO_SCAN_SAMPLES 16
+#define RADIO_SCAN_DWELL_MICROS 200 // RPD needs 170 us of receiving
+#define RADIO_SWITCH_ATTEMPTS 3
+#define RETRANSMIT_AVERAGE_SHIFT 3 // smoothed over 8 packets
+
+struct link_stats {
+  uint32_t loss_history; // a bit per packet, newest lowest, 1 for lost
+  uint8_t history_length; // up to 32
+  uint8_t last_retransmits;
+  uint16_t retransmits_x16; // smoothed, in 16ths
+  uint32_t retransmits;
+  uint16_t strong; // listener: packets over -64 dBm
+  uint16_t weak;
+};
+
+struct listener_health {
+  uint16_t polls;
+  uint16_t answers;
+  uint32_t last_answer_millis;
+  uint32_t rtt_micros;
+};
+
+/*
+  Transmit power.  A broadcaster starts each channel at the PA level it last settled on
+  there, RF24_PA_MAX if it never has, and adjusts it from its ACKs.  It goes up a step when
+  RADIO_PA_UP_LOSSES of the last eight packets failed, or the smoothed retransmits reach
+  one a packet; it comes down a step after a run of packets that all went first time.  That
+  run starts at RADIO_PA_CLEAN_PACKETS and doubles each time a step down has to be taken
+  back, so a marginal level isn't tried over and over.  After any step the level holds for
+  RADIO_PA_HOLD_PACKETS, long enough for the old losses to leave the history.  A level that
+  lasts RADIO_PA_SAVE_PACKETS is saved for its channel.  Starting high and only coming down
+  on clean runs means commands aren't lost while a level is being found.  Only packets to
+  everyone count.  Multicast packets have no ACKs to go on, so with multicast on the
+  broadcaster sends at RF24_PA_MAX, and works down again from there once it is off.
+  Listeners stay at RF24_PA_MAX: their ACKs are all the broadcaster has to go on.
+
+  Airtime is added up by level for an energy estimate, using the nRF24L01+ datasheet's
+  transmit current at each level: -18, -12, -6 and 0 dBm.
+*/
+#define RADIO_PA_LEVELS 4 // RF24_PA_MIN..RF24_PA_MAX
+#define RADIO_PA_UP_LOSSES 2
+#define RADIO_PA_UP_RETRANSMITS_X16 16
+#define RADIO_PA_CLEAN_PACKETS 64
+#define RADIO_PA_MAX_BACKOFF 3 // up to 512 clean packets
+#define RADIO_PA_HOLD_PACKETS 16
+#define RADIO_PA_SAVE_PACKETS 256
+#define RADIO_PA_MILLIAMPS { 7.0, 7.5, 9.0, 11.3 }
+#define RADIO_SUPPLY_VOLTS 3.3
+
+struct radio_power {
+  uint8_t level;
+  uint8_t holdoff; // packets before it may step again
+  uint8_t backoff; // doublings of the clean run needed to step down
+  bool last_step_down;
+  uint16_t clean; // packets in a row that went first time
+  uint16_t held; // packets at this level, for saving it
+  uint16_t steps_up;
+  uint16_t steps_down;
+  uint32_t airtime_micros[RADIO_PA_LEVELS];
 };
   
 void state_stopped(void);
+void set_clock_millis(int32_t clock_millis);
+void horn(uint16_t tenths);
+void update_clock_tick(int8_t celsius);
+void start_clock_calibration(void);
+void add_clock_calibration_reference(int32_t reference_millis);
+bool clock_calibration_ppm(int16_t *ppm);
+void reset_sleep_stats(void);
+void snapshot_loop_time(void);
+void start_timer(uint8_t timer, uint32_t delay_millis, uint32_t period_millis);
+void stop_timer(uint8_t timer);
+bool is_timer_armed(uint8_t timer);
+bool next_timer_due(uint32_t *due_millis);
+void run_timers(uint32_t current_millis);
+void reset_loop_stats(void);
 void state_running(void);
+void update_remote_clock(void);
 void load_settings(void);
 bool save_settings(void);
 void reset_settings(void);
 void set_led_brightness(void);
 void display_dirty(struct display_info *display);
-void switch_to_primary_buffer(void);
-void switch_to_transitory_buffer(void);
+void set_display_layer(struct display_info *display, uint8_t layer, const char *contents, uint16_t duration_millis);
+void clear_display_layer(struct display_info *display, uint8_t layer);
+void clear_overlays(void);
+bool is_display_layer_active(struct display_info *display, uint8_t layer);
 void set_display(struct display_info *display, char *contents);
+void update_displays(void);
 void print_buttons(uint8_t buttons);
-int compare_active_display_buffer(struct display_info *display, char *contents);
 void update_radio(void);
 bool send_radio_command(uint8_t command);
+bool switch_radio_channel(uint8_t channel);
+bool start_channel_scan(void);
+int8_t quietest_channel(void);
+uint8_t saved_radio_power(uint8_t channel);
+void service_radio_transmit(void);
+bool poll_radio_transmit(void);
+void reset_radio_transmit(void);
 void wrap_range(int8_t *value, int8_t min, int8_t max);
 void send_radio_command_show_time_if_necessary(void);
 void print_radio_mode(void);
@@ -0,0 +1,182 @@
+/*
+  MIT License
+
+  Copyright (c) 2022 Delta Z Technical Services, LLC, Austin, TX.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  The debouncer and its edge stamps against bounce traces, with the sampler run the way
+  the Timer1 ISR runs it: woken by a pin change, sampling on the next 1 ms tick and then
+  every DEBOUNCE_MILLIS, and going back to sleep once every input agrees.
+
+  The traces are edge lists shaped like scope captures of pushbuttons: a burst of short
+  pulses that starts at the first contact and dies out over up to a few milliseconds,
+  on press and on release.  A trace is (micros, raw inputs) pairs.
+*/
+
+#include <vector>
+#include "test.h"
+#include "debounce.h"
+
+#define DEBOUNCE_MILLIS 2 // DEFAULT_DEBOUNCE_SAMPLE_MILLIS
+#define BUTTON_A 0x01
+#define BUTTON_B 0x02
+
+struct edge {
+  uint32_t micros;
+  uint8_t raw;
+};
+
+struct event {
+  uint32_t micros; // when the debouncer accepted it
+  uint32_t edge_micros; // its stamp
+  uint8_t changed;
+  uint8_t level;
+};
+
+static std::vector<struct event> run(const std::vector<struct edge> &edges, uint32_t end_micros) {
+  struct debouncer d;
+  struct debounce_stamps s;
+  std::vector<struct event> events;
+  uint8_t raw = 0;
+  debounce_reset(&d, raw);
+  debounce_stamps_reset(&s, raw);
+  bool awake = false;
+  uint8_t countdown = 1;
+  size_t next = 0;
+  for(uint32_t tick = 1000; tick <= end_micros; tick += 1000) {
+    // the pin change ISRs, in order, up to this tick
+    while(next < edges.size() && edges[next].micros < tick) {
+      raw = edges[next].raw;
+      debounce_edge(&d, &s, raw, edges[next].micros);
+      if(!awake) {
+	awake = true;
+	countdown = 1;
+      }
+      next++;
+    }
+    if(awake && --countdown == 0) {
+      countdown = DEBOUNCE_MILLIS;
+      uint8_t toggled = debounce_sample(&d, raw);
+      uint32_t edge_micros = debounce_stamp_sample(&d, &s, raw, toggled, tick);
+      if(toggled) {
+	struct event e = { tick, edge_micros, toggled, d.level };
+	events.push_back(e);
+      }
+      if(!debounce_pending(&d, raw))
+	awake = false;
+    }
+  }
+  return events;
+}
+
+static void add_bounce(std::vector<struct edge> *edges, uint32_t start, uint32_t bounce_micros,
+		       uint8_t other, uint8_t bit, bool to_on) {
+  // pulses that get shorter apart as the contact settles, ending on the new level
+  uint8_t on = other | bit, off = other & ~bit;
+  uint32_t t = start;
+  uint32_t gap = bounce_micros / 4 + 1;
+  bool level = to_on;
+  while(t < start + bounce_micros) {
+    struct edge e = { t, (uint8_t)(level ? on : off) };
+    edges->push_back(e);
+    t += gap;
+    gap = gap * 3 / 4 + 20;
+    level = !level;
+  }
+  struct edge last = { t, (uint8_t)(to_on ? on : off) };
+  edges->push_back(last);
+}
+
+static void test_traces() {
+  // press and release, each with this much bounce
+  const uint32_t bounces[] = { 0, 300, 1500, 3000, 6000 };
+  const uint32_t stable_micros = (DEBOUNCE_SAMPLES + 1) * DEBOUNCE_MILLIS * 1000;
+  printf("Press latency from the first edge (bounce, sample %d ms):\n", DEBOUNCE_MILLIS);
+  for(size_t i = 0; i < sizeof(bounces) / sizeof(bounces[0]); i++) {
+    std::vector<struct edge> edges;
+    uint32_t press = 5000 + test_random(1000);
+    uint32_t release = press + 100000;
+    add_bounce(&edges, press, bounces[i], 0, BUTTON_A, true);
+    add_bounce(&edges, release, bounces[i], 0, BUTTON_A, false);
+    std::vector<struct event> events = run(edges, release + 50000);
+
+    CHECK(events.size() == 2); // every bounce rejected
+    if(events.size() != 2)
+      continue;
+    CHECK(events[0].changed == BUTTON_A && events[0].level == BUTTON_A);
+    CHECK(events[1].changed == BUTTON_A && events[1].level == 0);
+    CHECK(events[0].edge_micros == press);
+    CHECK(events[1].edge_micros == release);
+    uint32_t latency = events[0].micros - press;
+    CHECK(latency <= bounces[i] + stable_micros);
+    printf("  %4lu us bounce: %5lu us\n", (unsigned long)bounces[i], (unsigned long)latency);
+  }
+}
+
+static void test_glitch() {
+  // an 80 us spike is no press, and leaves no stamp behind for the real press
+  std::vector<struct edge> edges;
+  struct edge up = { 5000, BUTTON_A }, down = { 5080, 0 };
+  edges.push_back(up);
+  edges.push_back(down);
+  add_bounce(&edges, 40000, 1000, 0, BUTTON_A, true);
+  std::vector<struct event> events = run(edges, 80000);
+  CHECK(events.size() == 1);
+  if(events.size() == 1)
+    CHECK(events[0].edge_micros == 40000);
+}
+
+static void test_second_button() {
+  // B pressed while the sampler is still awake from A gets its own stamp, not A's time
+  std::vector<struct edge> edges;
+  add_bounce(&edges, 1200, 1500, 0, BUTTON_A, true);
+  std::vector<struct event> first = run(edges, 30000);
+  CHECK(first.size() == 1);
+  if(first.size() != 1)
+    return;
+  uint32_t b_press = first[0].micros + 300;
+  add_bounce(&edges, b_press, 800, BUTTON_A, BUTTON_B, true);
+  std::vector<struct event> events = run(edges, 60000);
+  CHECK(events.size() == 2);
+  if(events.size() == 2) {
+    CHECK(events[1].changed == BUTTON_B);
+    CHECK(events[1].edge_micros == b_press);
+  }
+
+  // both pressed together: one event with the earlier stamp
+  edges.clear();
+  add_bounce(&edges, 3000, 500, 0, BUTTON_A, true);
+  add_bounce(&edges, 3700, 0, BUTTON_A, BUTTON_B, true);
+  events = run(edges, 30000);
+  CHECK(events.size() == 1);
+  if(events.size() == 1) {
+    CHECK(events[0].changed == (BUTTON_A | BUTTON_B));
+    CHECK(events[0].edge_micros == 3000);
+  }
+}
+
+int main() {
+  test_traces();
+  test_glitch();
+  test_second_button();
+  return test_result("debounce");
+}
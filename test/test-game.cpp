@@ -0,0 +1,125 @@
+/*
+  MIT License
+
+  Copyright (c) 2022 Delta Z Technical Services, LLC, Austin, TX.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Whole games on a simulated clock.  time-source.h, built with SIMULATED_TIME, stands in
+  for millis() and micros() and runs the 1 kHz tick as simulated time crosses each
+  millisecond, as Timer1 does on the clock.  The tick here is countdown_tick()'s
+  countdown step, with the tick length the clock calibration would set.
+
+  A game is four 12-minute periods of 24 s shot clocks, each reset somewhere in its
+  count, run by loop() passes of 1 to 20 ms that start the clock and watch for it
+  expiring, the way the sketch does.  Each shot clock has to reach zero on exactly the
+  tick the calibrated tick length says it should, and the whole game runs far faster
+  than it would on the wall.
+*/
+
+#include <time.h>
+#include "test.h"
+
+#define SIMULATED_TIME
+#include "time-source.h"
+#include "countdown.h"
+
+#define GAMES 4
+#define PERIODS 4
+#define PERIOD_MILLIS (12 * 60 * 1000L)
+#define SHOT_CLOCK_MILLIS 24000
+
+static volatile struct countdown g_countdown;
+static uint32_t g_tick_q24 = TICK_Q24_NOMINAL;
+static uint32_t g_ticks = 0; // since the shot clock started
+static uint32_t g_zero_ticks = 0; // the tick that reached zero
+
+static void countdown_tick(void) {
+  g_ticks++;
+  if(countdown_step(&g_countdown, g_tick_q24))
+    g_zero_ticks = g_ticks;
+}
+
+static uint32_t tick_q24_for_ppm(int32_t ppm) {
+  // as update_clock_tick()
+  return TICK_Q24_NOMINAL - (ppm * 16777L) / 1000;
+}
+
+static void start_shot_clock(int32_t millis) {
+  g_countdown.millis = millis;
+  g_countdown.fraction_q24 = 0;
+  g_countdown.expired = false;
+  g_ticks = 0;
+  g_zero_ticks = 0;
+  g_countdown.running = true;
+}
+
+/* run loop() until the shot clock expires or is reset; false if it was reset */
+static bool run_shot_clock(uint32_t reset_millis) {
+  uint32_t start_millis = time_source_millis();
+  while(!g_countdown.expired) {
+    if(time_source_millis() - start_millis >= reset_millis) {
+      g_countdown.running = false;
+      return false;
+    }
+    advance_simulated_time(1000 + test_random(19000));
+  }
+  return true;
+}
+
+static void play_game(int32_t ppm, uint32_t *shot_clocks, uint32_t *expired) {
+  g_tick_q24 = tick_q24_for_ppm(ppm);
+  // the tick count the fractions add up to 24 s on
+  uint64_t expected_ticks = (((uint64_t)SHOT_CLOCK_MILLIS << 24) + g_tick_q24 - 1) / g_tick_q24;
+  for(int period = 0; period < PERIODS; period++) {
+    uint32_t period_start = time_source_millis();
+    while(time_source_millis() - period_start < PERIOD_MILLIS) {
+      start_shot_clock(SHOT_CLOCK_MILLIS);
+      bool reached_zero = run_shot_clock(test_random(100) < 30 ? 30000 : 3000 + test_random(20000));
+      (*shot_clocks)++;
+      if(reached_zero) {
+	(*expired)++;
+	CHECK(g_zero_ticks == expected_ticks);
+	CHECK(g_countdown.millis == 0 && !g_countdown.running);
+      } else {
+	CHECK(g_zero_ticks == 0 && g_countdown.millis > 0);
+      }
+    }
+  }
+}
+
+int main() {
+  static const int32_t ppms[GAMES] = { 0, 2500, -2500, 40 };
+  g_simulated_time.tick = countdown_tick;
+  clock_t host_start = clock();
+  uint32_t shot_clocks = 0, expired = 0;
+  for(int game = 0; game < GAMES; game++)
+    play_game(ppms[game], &shot_clocks, &expired);
+  double host_seconds = (double)(clock() - host_start) / CLOCKS_PER_SEC;
+  double simulated_seconds = g_simulated_time.millis / 1e3;
+
+  printf("%d games, %lu shot clocks, %lu run out: %.0f s simulated in %.3f s\n", GAMES,
+	 (unsigned long)shot_clocks, (unsigned long)expired, simulated_seconds, host_seconds);
+  CHECK(expired > 0 && expired < shot_clocks);
+  CHECK(simulated_seconds >= GAMES * PERIODS * PERIOD_MILLIS / 1000.0);
+  CHECK(host_seconds < simulated_seconds / 100);
+  return test_result("game");
+}
@@ -0,0 +1,168 @@
+/*
+  MIT License
+
+  Copyright (c) 2022 Delta Z Technical Services, LLC, Austin, TX.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Horn length error, simulated.  The old horn was timed by loop(): each pass subtracted
+  the millis since the last one, and the pass after the count went non-positive turned
+  the relay off.  Now the relay goes off from the 1 kHz Timer1 tick, which front show()s
+  can hold off; missed-ticks.h says how many ticks to replay after each show.
+
+  loop() passes here are mostly short, with some long ones (a serial line, the old
+  blocking radio writes) and a two-digit front refresh every 20 ms.  The horn is turned on
+  from loop() at the end of a pass, and sounds for the default 1.3 s.
+*/
+
+#include <vector>
+#include "test.h"
+#include "missed-ticks.h"
+
+#define HORN_MILLIS 1300
+#define TRIALS 2000
+#define REFRESH_MICROS 20000
+#define SHOW_MICROS 1500 // one 50-pixel RGB digit
+#define FRONT_DIGITS 2
+
+struct interval {
+  uint32_t start;
+  uint32_t end;
+};
+
+struct trial {
+  std::vector<uint32_t> pass_ends; // micros
+  std::vector<struct interval> shows; // interrupts off
+};
+
+static uint32_t pass_micros() {
+  uint32_t r = test_random(100);
+  if(r < 70)
+    return 1000 + test_random(2000);
+  if(r < 95)
+    return 5000 + test_random(15000);
+  return 30000 + test_random(30000);
+}
+
+static void make_trial(struct trial *t) {
+  uint32_t now = test_random(1000000); // any phase against the tick
+  uint32_t next_refresh = now + test_random(REFRESH_MICROS);
+  t->pass_ends.push_back(now); // the horn goes on here
+  while(now < t->pass_ends[0] + (HORN_MILLIS + 200) * 1000) {
+    now += pass_micros();
+    if(now >= next_refresh) {
+      for(int digit = 0; digit < FRONT_DIGITS; digit++) {
+	struct interval show = { now, now + SHOW_MICROS + test_random(20) };
+	t->shows.push_back(show);
+	now = show.end + 10;
+      }
+      next_refresh += REFRESH_MICROS;
+    }
+    t->pass_ends.push_back(now);
+  }
+}
+
+static int32_t loop_timed_error(const struct trial *t) {
+  // the old update_horn_state(), run at the end of every pass
+  int32_t horn_timer_millis = HORN_MILLIS;
+  uint32_t last_millis = t->pass_ends[0] / 1000;
+  for(size_t i = 1; i < t->pass_ends.size(); i++) {
+    uint32_t now_millis = t->pass_ends[i] / 1000;
+    if(horn_timer_millis > 0) {
+      horn_timer_millis -= now_millis - last_millis;
+    } else {
+      return (int32_t)(t->pass_ends[i] - t->pass_ends[0]) - HORN_MILLIS * 1000;
+    }
+    last_millis = now_millis;
+  }
+  return -1;
+}
+
+static int32_t tick_timed_error(const struct trial *t, bool replay) {
+  // Timer1 compare matches every 1000 us; during a show only the first is kept pending
+  uint16_t ticks = HORN_MILLIS;
+  uint32_t tick = (t->pass_ends[0] / 1000 + 1) * 1000;
+  size_t show = 0;
+  for(;;) {
+    while(show < t->shows.size() && t->shows[show].end <= tick)
+      show++;
+    uint32_t when = tick;
+    uint32_t counted = 1;
+    if(show < t->shows.size() && t->shows[show].start <= tick) {
+      // held off until the show ends, with anything after the first lost or replayed
+      const struct interval *s = &t->shows[show];
+      when = s->end;
+      uint32_t matches = s->end / 1000 - s->start / 1000;
+      tick += (matches - 1) * 1000;
+      if(replay) {
+	counted += missed_timer1_ticks((s->start / TIMER1_MICROS_PER_COUNT) % TIMER1_TICK_COUNTS,
+				       (s->end / TIMER1_MICROS_PER_COUNT) % TIMER1_TICK_COUNTS,
+				       SHOW_MICROS / TIMER1_MICROS_PER_COUNT);
+      }
+    }
+    tick += 1000;
+    if(counted >= ticks)
+      return (int32_t)(when - t->pass_ends[0]) - HORN_MILLIS * 1000;
+    ticks -= counted;
+  }
+}
+
+struct error_stats {
+  int64_t total;
+  int32_t min;
+  int32_t max;
+};
+
+static void add_error(struct error_stats *stats, int32_t error) {
+  stats->total += error;
+  if(error < stats->min)
+    stats->min = error;
+  if(error > stats->max)
+    stats->max = error;
+}
+
+static void print_error(const char *name, const struct error_stats *stats) {
+  printf("  %-22s mean %+7.2f ms, min %+7.2f ms, max %+7.2f ms\n", name,
+	 stats->total / 1000.0 / TRIALS, stats->min / 1000.0, stats->max / 1000.0);
+}
+
+int main() {
+  struct error_stats loop_timed = { 0, INT32_MAX, INT32_MIN };
+  struct error_stats ticks_lost = { 0, INT32_MAX, INT32_MIN };
+  struct error_stats ticks_replayed = { 0, INT32_MAX, INT32_MIN };
+  for(int i = 0; i < TRIALS; i++) {
+    struct trial t;
+    make_trial(&t);
+    add_error(&loop_timed, loop_timed_error(&t));
+    add_error(&ticks_lost, tick_timed_error(&t, false));
+    add_error(&ticks_replayed, tick_timed_error(&t, true));
+  }
+  printf("Horn length error over %d horns of %d ms:\n", TRIALS, HORN_MILLIS);
+  print_error("timed by loop()", &loop_timed);
+  print_error("1 kHz tick, no replay", &ticks_lost);
+  print_error("1 kHz tick, replayed", &ticks_replayed);
+
+  // exact to the tick, less up to one tick of phase, plus at most a show holding it off
+  CHECK(ticks_replayed.min > -1000);
+  CHECK(ticks_replayed.max <= FRONT_DIGITS * (SHOW_MICROS + 30));
+  CHECK(loop_timed.max > ticks_replayed.max);
+  return test_result("horn-timing");
+}
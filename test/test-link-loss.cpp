@@ -0,0 +1,214 @@
+/*
+  MIT License
+
+  Copyright (c) 2022 Delta Z Technical Services, LLC, Austin, TX.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  What heartbeats cost, and how soon a listener notices the link is gone.  The clock is
+  stopped throughout, so heartbeats are all the broadcaster sends.  Its heartbeat timer
+  asks heartbeat_due() every RADIO_HEARTBEAT_CHECK_MILLIS; the packet starts a
+  millisecond or two later, from service_radio_transmit().  The listener runs its
+  link_watch as the sketch does: a one-shot timer of link_loss_window(), restarted by
+  every valid packet, that asks link_watch_expired() when it fires.
+
+  Airtime is RADIO_AIR_MICROS() from radio-packet.h.  A unicast heartbeat waits for an
+  ACK carrying the listener's 20 byte status, and the transceiver retries every
+  (RADIO_DELAY + 1) * 250 us; a multicast one goes out RADIO_MULTICAST_COPIES times.
+*/
+
+#include <algorithm>
+#include "test.h"
+#include "radio-packet.h"
+#include "link-watch.h"
+
+// as in shot-clock.h
+#define RADIO_MULTICAST_COPIES 3
+#define RADIO_DELAY 5
+#define RADIO_RETRIES 15
+#define MAX_TRANSMISSION_RETRIES 1
+
+#define PACKET_MICROS RADIO_AIR_MICROS(RADIO_PACKET_SIZE)
+#define ACK_MICROS RADIO_AIR_MICROS(RADIO_ACK_SIZE)
+#define RETRY_MICROS ((RADIO_DELAY + 1) * 250)
+
+#define HOURS 10
+
+struct heartbeat_run {
+  uint32_t heartbeats;
+  uint64_t air_micros;
+  uint32_t losses; // before the broadcaster went away: false alarms
+  uint32_t detected_millis; // the first loss after it did
+  uint32_t gap_max_millis; // longest time between valid packets at the listener
+};
+
+struct listener {
+  struct link_watch watch;
+  uint32_t timer_due; // TIMER_LINK_LOSS
+  bool timer_armed;
+  uint32_t last_heard;
+};
+
+static void run_link_loss_timer(struct listener *l, uint32_t now, uint32_t death, struct heartbeat_run *run) {
+  // link_loss_timer(), for every time TIMER_LINK_LOSS came due up to now
+  while(l->timer_armed && l->timer_due <= now) {
+    uint32_t due = l->timer_due;
+    l->timer_armed = false;
+    if(link_watch_expired(&l->watch, due, DEFAULT_LINK_LOSS_MILLIS)) {
+      if(due < death)
+	run->losses++;
+      else if(run->detected_millis == 0)
+	run->detected_millis = due;
+    } else if(!l->watch.lost) {
+      l->timer_due = due + link_watch_remaining(&l->watch, due, DEFAULT_LINK_LOSS_MILLIS);
+      l->timer_armed = true;
+    }
+  }
+}
+
+static void hear(struct listener *l, uint32_t now, uint32_t death, struct heartbeat_run *run) {
+  // link_contact()
+  run_link_loss_timer(l, now, death, run);
+  run->gap_max_millis = std::max(run->gap_max_millis, now - l->last_heard);
+  l->last_heard = now;
+  l->timer_due = now + link_loss_window(DEFAULT_LINK_LOSS_MILLIS);
+  l->timer_armed = true;
+  link_watch_contact(&l->watch, now);
+}
+
+/* One heartbeat, starting at now; returns whether the listener heard it, and when. */
+static bool send_heartbeat(bool multicast, unsigned loss_percent, uint32_t now, uint32_t *heard,
+			   struct heartbeat_run *run) {
+  bool delivered = false;
+  if(multicast) {
+    for(int copy = 0; copy < RADIO_MULTICAST_COPIES; copy++) {
+      run->air_micros += PACKET_MICROS;
+      if(!delivered && test_random(100) >= loss_percent) {
+	delivered = true;
+	*heard = now + copy + 1;
+      }
+    }
+    return delivered;
+  }
+  uint32_t elapsed = 0;
+  for(int attempt = 0; attempt < (1 + RADIO_RETRIES) * (1 + MAX_TRANSMISSION_RETRIES); attempt++) {
+    run->air_micros += PACKET_MICROS;
+    elapsed += PACKET_MICROS;
+    if(test_random(100) >= loss_percent) {
+      if(!delivered)
+	*heard = now + elapsed / 1000 + 1;
+      delivered = true;
+      run->air_micros += ACK_MICROS;
+      if(test_random(100) >= loss_percent)
+	return true; // ACKed
+    }
+    elapsed += RETRY_MICROS;
+  }
+  return delivered;
+}
+
+/* Heartbeats until end; the broadcaster goes away at death. */
+static void run_heartbeats(bool multicast, unsigned loss_percent, uint32_t end, uint32_t death,
+			   struct heartbeat_run *run) {
+  memset(run, 0, sizeof(*run));
+  struct listener l;
+  memset(&l, 0, sizeof(l));
+  hear(&l, 0, death, run);
+  uint32_t last_tx = 0;
+  for(uint32_t check = RADIO_HEARTBEAT_CHECK_MILLIS; check < end; check += RADIO_HEARTBEAT_CHECK_MILLIS) {
+    run_link_loss_timer(&l, check, death, run);
+    if(check >= death || !heartbeat_due(check, last_tx))
+      continue;
+    uint32_t start = check + test_random(3);
+    last_tx = start;
+    run->heartbeats++;
+    uint32_t heard = 0;
+    if(send_heartbeat(multicast, loss_percent, start, &heard, run) && heard < death)
+      hear(&l, heard, death, run);
+  }
+  run_link_loss_timer(&l, end, death, run);
+}
+
+static void test_airtime(bool multicast, unsigned loss_percent) {
+  struct heartbeat_run run;
+  uint32_t end = (uint32_t)HOURS * 3600 * 1000;
+  run_heartbeats(multicast, loss_percent, end, end, &run);
+  double seconds = HOURS * 3600.0;
+  printf("  %-9s loss %2u%%: a heartbeat every %4.0f ms, %5.3f%% of the air, longest gap %4u ms, %u false losses in %u h\n",
+	 multicast ? "multicast" : "unicast", loss_percent, seconds * 1000 / run.heartbeats,
+	 run.air_micros / (seconds * 1e6) * 100, run.gap_max_millis, run.losses, HOURS);
+  CHECK(run.air_micros / (seconds * 1e6) < 0.01);
+  if(loss_percent == 0) {
+    CHECK(run.gap_max_millis <= RADIO_HEARTBEAT_MILLIS + 3);
+    CHECK(run.losses == 0);
+  }
+}
+
+static void test_detection(bool multicast, unsigned loss_percent) {
+  // the broadcaster goes away at a random moment; how long until the listener says so
+  uint32_t latency_min = UINT32_MAX, latency_max = 0;
+  double latency_sum = 0;
+  const int trials = 10000;
+  for(int trial = 0; trial < trials; trial++) {
+    struct heartbeat_run run;
+    uint32_t death = 60000 + test_random(10000);
+    run_heartbeats(multicast, loss_percent, death + 2 * DEFAULT_LINK_LOSS_MILLIS, death, &run);
+    CHECK(run.detected_millis > 0);
+    uint32_t latency = run.detected_millis - death;
+    latency_min = std::min(latency_min, latency);
+    latency_max = std::max(latency_max, latency);
+    latency_sum += latency;
+  }
+  printf("  %-9s loss %2u%%: link loss shown %4u-%4u ms after it happened, mean %4.0f ms\n",
+	 multicast ? "multicast" : "unicast", loss_percent, latency_min, latency_max, latency_sum / trials);
+  CHECK(latency_max <= DEFAULT_LINK_LOSS_MILLIS);
+  if(loss_percent == 0)
+    CHECK(latency_min >= DEFAULT_LINK_LOSS_MILLIS - RADIO_HEARTBEAT_MILLIS - 3);
+}
+
+static void test_longer_window() {
+  // linkloss made longer while the timer was running: the loss waits for the new window
+  struct link_watch watch;
+  memset(&watch, 0, sizeof(watch));
+  link_watch_contact(&watch, 1000);
+  CHECK(!link_watch_expired(&watch, 4000, 5000));
+  CHECK(link_watch_remaining(&watch, 4000, 5000) == 2000);
+  CHECK(link_watch_expired(&watch, 6000, 5000) && watch.losses == 1);
+  CHECK(!link_watch_expired(&watch, 9000, 5000) && watch.losses == 1);
+  CHECK(link_watch_contact(&watch, 9500) && !watch.lost);
+  CHECK(link_loss_window(200) == RADIO_HEARTBEAT_MILLIS);
+}
+
+int main() {
+  test_longer_window();
+  printf("Heartbeats with the clock stopped, %u h:\n", HOURS);
+  for(int multicast = 0; multicast <= 1; multicast++) {
+    test_airtime(multicast, 0);
+    test_airtime(multicast, 30);
+    test_airtime(multicast, 60);
+  }
+  printf("Link loss detection, window %u ms:\n", DEFAULT_LINK_LOSS_MILLIS);
+  for(int multicast = 0; multicast <= 1; multicast++) {
+    test_detection(multicast, 0);
+    test_detection(multicast, 30);
+  }
+  return test_result("link-loss");
+}
@@ -0,0 +1,102 @@
+/*
+  MIT License
+
+  Copyright (c) 2022 Delta Z Technical Services, LLC, Austin, TX.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  missed_timer1_ticks() against a model of Timer1 in CTC mode, and the countdown error
+  with and without replaying the ticks, with the front refreshing every 20 ms.
+*/
+
+#include "test.h"
+#include "missed-ticks.h"
+
+#define PIXELS_PER_DIGIT 50 // the 7-pixel build; the 8-pixel one has 57
+#define FRONT_DIGITS 2
+#define SHOW_MICROS (PIXELS_PER_DIGIT * 3 * NEOPIXEL_MICROS_PER_BYTE)
+#define SHOW_COUNTS (SHOW_MICROS / TIMER1_MICROS_PER_COUNT)
+
+static uint8_t counter_at(uint32_t micros) {
+  return (micros / TIMER1_MICROS_PER_COUNT) % TIMER1_TICK_COUNTS;
+}
+
+static uint32_t matches_between(uint32_t start_micros, uint32_t end_micros) {
+  uint32_t tick_micros = TIMER1_TICK_COUNTS * TIMER1_MICROS_PER_COUNT;
+  return end_micros / tick_micros - start_micros / tick_micros;
+}
+
+static void test_against_model() {
+  // any starting phase, with the show running up to 100 us long or short of nominal
+  for(int i = 0; i < 100000; i++) {
+    uint32_t start = test_random(1000000);
+    uint32_t length = SHOW_MICROS - 100 + test_random(200);
+    uint32_t matches = matches_between(start, start + length);
+    uint8_t expected = matches > 1 ? matches - 1 : 0;
+    CHECK(missed_timer1_ticks(counter_at(start), counter_at(start + length), SHOW_COUNTS) == expected);
+  }
+  // shows shorter than a tick never lose one
+  for(uint32_t start = 0; start < 1000; start += 4) {
+    CHECK(missed_timer1_ticks(counter_at(start), counter_at(start + 300), 300 / TIMER1_MICROS_PER_COUNT) == 0);
+  }
+}
+
+static int32_t run_countdown(uint32_t game_millis, uint32_t refresh_millis, bool replay) {
+  // milliseconds the countdown is behind real time at the end
+  uint32_t counted = 0;
+  uint32_t now = 0; // micros
+  uint32_t next_refresh = 0;
+  uint32_t end = game_millis * 1000;
+  while(now < end) {
+    if(now >= next_refresh) {
+      next_refresh += refresh_millis * 1000;
+      for(int digit = 0; digit < FRONT_DIGITS; digit++) {
+	uint32_t length = SHOW_MICROS + test_random(20); // a few us of setup
+	uint32_t matches = matches_between(now, now + length);
+	if(matches > 0)
+	  counted++; // the one left pending runs the ISR when interrupts come back
+	if(replay)
+	  counted += missed_timer1_ticks(counter_at(now), counter_at(now + length), SHOW_COUNTS);
+	now += length;
+      }
+      continue;
+    }
+    uint32_t step = 1000 - now % 1000; // to the next compare match
+    now += step;
+    counted++;
+  }
+  return (int32_t)(now / 1000) - (int32_t)counted;
+}
+
+static void measure_countdown() {
+  int32_t lost = run_countdown(60000, 20, false);
+  int32_t replayed = run_countdown(60000, 20, true);
+  printf("60 s countdown, front refreshed every 20 ms: %ld ms slow without replay, %ld ms with\n",
+	 (long)lost, (long)replayed);
+  CHECK(lost > 0);
+  CHECK(abs(replayed) <= 1);
+}
+
+int main() {
+  test_against_model();
+  measure_countdown();
+  return test_result("missed-ticks");
+}
@@ -0,0 +1,193 @@
+/*
+  MIT License
+
+  Copyright (c) 2022 Delta Z Technical Services, LLC, Austin, TX.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  One broadcaster and several listeners over links that lose packets, with the
+  broadcaster sending every packet RADIO_MULTICAST_COPIES times and each listener taking
+  the first copy it hears.  A copy spends RADIO_AIR_MICROS() in the air, about 0.97 ms,
+  and the next one starts on the first 1 ms tick after that, when the transmit is
+  polled; a listener reads its FIFO on its next 2 ms event tick.  Loss is either independent or in bursts (a link
+  that drops everything for a while, like a player standing in front of the antenna),
+  and now and then a copy arrives damaged and fails its CRC.
+
+  Checked: no packet's commands are taken twice, the listener's lost count matches the
+  packets it really missed (less gaps long enough to read as a broadcaster restart), and
+  with independent loss multicast copies turn 30% loss into about 3%.  Bursts longer
+  than the copies' 3-5 ms spread take every copy, so there copies help much less.  Latency
+  from the first copy sent to the packet being taken is printed.
+*/
+
+#include <vector>
+#include <algorithm>
+#include "test.h"
+#include "radio-packet.h"
+
+#define RADIO_MULTICAST_COPIES 3 // as in shot-clock.h
+#define TICK_MICROS 1000 // the transmit is polled once a tick
+#define PACKET_AIR_MICROS RADIO_AIR_MICROS(RADIO_PACKET_SIZE)
+#define LISTEN_EVENT_TICK_MICROS 2000
+#define LISTENERS 3
+#define PACKETS 20000
+#define PACKET_INTERVAL_MICROS 100000 // a tenth, the fastest the front display changes
+
+struct link {
+  unsigned loss_percent; // per copy, outside bursts
+  uint32_t burst_micros; // how long a burst drops everything
+  uint32_t burst_interval_micros; // mean time from one burst to the next
+  uint32_t burst_start, burst_end;
+};
+
+struct listener {
+  struct radio_sequence sequence;
+  uint16_t lost; // by its own count, from sequence gaps
+  uint32_t taken, bad, duplicates, twice;
+  uint32_t missed; // by the simulator's count
+  std::vector<bool> seen;
+  std::vector<uint32_t> latencies;
+};
+
+static bool link_drops(struct link *l, uint32_t now) {
+  while(l->burst_micros > 0 && now >= l->burst_end) {
+    l->burst_start = l->burst_end + test_random(2 * l->burst_interval_micros);
+    l->burst_end = l->burst_start + l->burst_micros;
+  }
+  if(l->burst_micros > 0 && now >= l->burst_start)
+    return true;
+  return test_random(100) < l->loss_percent;
+}
+
+/* Returns the worst listener's share of packets missed. */
+static double simulate(const char *name, struct link *links, int copies) {
+  struct listener listeners[LISTENERS];
+  for(int n = 0; n < LISTENERS; n++) {
+    links[n].burst_start = links[n].burst_end = 0;
+    memset(&listeners[n].sequence, 0, sizeof(listeners[n].sequence));
+    listeners[n].lost = 0;
+    listeners[n].taken = listeners[n].bad = listeners[n].duplicates = listeners[n].twice = 0;
+    listeners[n].missed = 0;
+    listeners[n].seen.assign(PACKETS, false);
+    listeners[n].latencies.clear();
+  }
+
+  struct radio_message m;
+  memset(&m, 0, sizeof(m));
+  m.multicast = 1;
+  m.clock_running = 1;
+  uint16_t sequence = 0xfff0; // wraps during the run
+  for(uint32_t p = 0; p < PACKETS; p++) {
+    uint32_t first_send = p * PACKET_INTERVAL_MICROS;
+    m.message_serial_number = ++sequence;
+    m.commands = RADIO_COMMAND_BIT(1);
+    // each copy starts on the tick after the last one finished
+    uint32_t sends[RADIO_MULTICAST_COPIES];
+    sends[0] = first_send;
+    for(int copy = 1; copy < copies; copy++) {
+      uint32_t done = sends[copy - 1] + PACKET_AIR_MICROS;
+      sends[copy] = done + 1 + test_random(TICK_MICROS);
+    }
+    for(int n = 0; n < LISTENERS; n++) {
+      struct listener *l = &listeners[n];
+      for(int copy = 0; copy < copies; copy++) {
+	uint32_t send = sends[copy];
+	m.send_micros = send;
+	uint8_t packet[RADIO_PACKET_SIZE];
+	encode_radio_message(&m, packet);
+	if(link_drops(&links[n], send))
+	  continue;
+	if(test_random(1000) == 0)
+	  packet[test_random(RADIO_PACKET_SIZE)] ^= 1 << test_random(8); // damaged, not lost
+
+	struct radio_message d;
+	if(decode_radio_message(packet, RADIO_PACKET_SIZE, &d) != RADIO_DECODE_OK) {
+	  l->bad++;
+	  continue;
+	}
+	if(!take_radio_sequence(&l->sequence, d.message_serial_number, &l->lost)) {
+	  l->duplicates++;
+	  continue;
+	}
+	if(l->seen[p])
+	  l->twice++;
+	l->seen[p] = true;
+	l->taken++;
+	// read on the listener's next event tick, which runs on its own clock
+	uint32_t read = send + PACKET_AIR_MICROS + 1 + test_random(LISTEN_EVENT_TICK_MICROS);
+	l->latencies.push_back(read - first_send);
+      }
+    }
+  }
+
+  double worst = 0;
+  printf("%s, %d cop%s:\n", name, copies, copies == 1 ? "y" : "ies");
+  for(int n = 0; n < LISTENERS; n++) {
+    struct listener *l = &listeners[n];
+    // the packets after the last one taken are missed, but no gap says so yet, and a
+    // gap over MAX_RADIO_SEQUENCE_GAP reads as a restart
+    uint32_t counted = 0, restarts = 0, gap = 0;
+    bool started = false;
+    for(uint32_t p = 0; p < PACKETS; p++) {
+      if(!l->seen[p]) {
+	l->missed++;
+	gap++;
+	continue;
+      }
+      if(started && gap <= MAX_RADIO_SEQUENCE_GAP)
+	counted += gap;
+      else if(started)
+	restarts++;
+      started = true;
+      gap = 0;
+    }
+    std::sort(l->latencies.begin(), l->latencies.end());
+    printf("  loss %2u%%, %3u ms bursts every %4u ms: missed %5.2f%%, %u restarts, bad %2u, copies dropped %5u, latency median %4u us, max %4u us\n",
+	   links[n].loss_percent, links[n].burst_micros / 1000, links[n].burst_interval_micros / 1000,
+	   100.0 * l->missed / PACKETS, restarts, l->bad, l->duplicates,
+	   l->latencies[l->latencies.size() / 2], l->latencies.back());
+
+    worst = std::max(worst, (double)l->missed / PACKETS);
+    CHECK(l->twice == 0);
+    CHECK(l->lost == counted);
+    CHECK(l->taken + l->missed == PACKETS);
+    CHECK(l->latencies.back() <= (uint32_t)(copies - 1) * (PACKET_AIR_MICROS + TICK_MICROS) + PACKET_AIR_MICROS + LISTEN_EVENT_TICK_MICROS);
+  }
+  return worst;
+}
+
+int main() {
+  struct link independent[LISTENERS] = { { 5, 0, 0, 0, 0 }, { 15, 0, 0, 0, 0 }, { 30, 0, 0, 0, 0 } };
+  struct link bursty[LISTENERS] = {
+    { 5, 2000, 1000000, 0, 0 }, { 5, 50000, 2000000, 0, 0 }, { 15, 300000, 5000000, 0, 0 }
+  };
+
+  simulate("Independent loss", independent, 1);
+  simulate("Independent loss", independent, RADIO_MULTICAST_COPIES);
+  {
+    // 0.3^3 of packets lose every copy
+    struct link l[LISTENERS] = { { 30, 0, 0, 0, 0 }, { 30, 0, 0, 0, 0 }, { 30, 0, 0, 0, 0 } };
+    CHECK(simulate("30% loss everywhere", l, RADIO_MULTICAST_COPIES) < 0.04);
+  }
+  simulate("Bursty loss", bursty, 1);
+  simulate("Bursty loss", bursty, RADIO_MULTICAST_COPIES);
+  return test_result("radio-link");
+}
@@ -0,0 +1,213 @@
+/*
+  MIT License
+
+  Copyright (c) 2022 Delta Z Technical Services, LLC, Austin, TX.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  The radio wire format: messages round-trip through a packet, and corrupted packets are
+  dropped.  CRC-16 catches every 1- and 2-bit error and every burst of up to 16 bits,
+  which covers two adjacent bytes swapped; other byte swaps and random damage are
+  counted against the 8-bit sum it replaced.  The ACK payload round-trips too.
+*/
+
+#include "test.h"
+#include "radio-packet.h"
+
+#define SYNC_OFFSET_UNKNOWN ((int32_t)0x80000000) // as in shot-clock.h
+
+static struct radio_message random_message() {
+  struct radio_message m;
+  memset(&m, 0, sizeof(m));
+  m.message_serial_number = test_random(0x10000);
+  m.commands = test_random(0x100);
+  m.clock_running = test_random(2);
+  m.multicast = test_random(2);
+  m.channel = test_random(126);
+  m.clock_millis = (int32_t)test_random(102000) - 2000;
+  m.send_micros = test_random(0x1000000) * 251;
+  m.offset_micros = test_random(4) ? (int32_t)test_random(2000000) - 1000000 : SYNC_OFFSET_UNKNOWN;
+  return m;
+}
+
+static uint8_t sum8(const uint8_t *packet) {
+  uint8_t sum = 0;
+  for(uint8_t i = 0; i < RADIO_PACKET_SIZE - 2; i++)
+    sum += packet[i];
+  return sum;
+}
+
+static void test_round_trip() {
+  // every 10 ms from -2 s to 100 s, and the odd millis in between round to nearest
+  for(int32_t millis = -2000; millis < 100000; millis++) {
+    struct radio_message m = random_message();
+    m.clock_millis = millis;
+    uint8_t packet[RADIO_PACKET_SIZE];
+    encode_radio_message(&m, packet);
+
+    struct radio_message d;
+    memset(&d, 0xa5, sizeof(d));
+    CHECK(decode_radio_message(packet, RADIO_PACKET_SIZE, &d) == RADIO_DECODE_OK);
+    int32_t rounded = (millis >= 0 ? millis + 5 : millis - 5) / 10 * 10;
+    CHECK(d.clock_millis == rounded);
+    CHECK(d.message_serial_number == m.message_serial_number);
+    CHECK(d.commands == m.commands);
+    CHECK(d.clock_running == m.clock_running);
+    CHECK(d.multicast == m.multicast);
+    CHECK(d.channel == m.channel);
+    CHECK(d.send_micros == m.send_micros);
+    CHECK(d.offset_micros == m.offset_micros);
+    if(g_test_failures)
+      return; // one is enough to see what broke
+  }
+}
+
+static void test_framing() {
+  struct radio_message m = random_message(), d;
+  uint8_t packet[RADIO_PACKET_SIZE];
+  encode_radio_message(&m, packet);
+  CHECK(decode_radio_message(packet, RADIO_PACKET_SIZE - 1, &d) == RADIO_DECODE_BAD_LENGTH);
+  CHECK(decode_radio_message(packet, RADIO_PACKET_SIZE + 1, &d) == RADIO_DECODE_BAD_LENGTH);
+  CHECK(decode_radio_message(packet, 0, &d) == RADIO_DECODE_BAD_LENGTH);
+
+  // a newer format with a good CRC is still dropped
+  packet[0] = (packet[0] & 0x0f) | ((RADIO_PACKET_VERSION + 1) << 4);
+  put_radio_16(packet + 15, crc16_ccitt(packet, RADIO_PACKET_SIZE - 2));
+  CHECK(decode_radio_message(packet, RADIO_PACKET_SIZE, &d) == RADIO_DECODE_BAD_VERSION);
+}
+
+static void test_corruption() {
+  struct radio_message m, d;
+  uint8_t good[RADIO_PACKET_SIZE], packet[RADIO_PACKET_SIZE];
+  const int bits = RADIO_PACKET_SIZE * 8;
+  uint32_t singles = 0, doubles = 0, missed = 0;
+  uint32_t adjacent = 0, swaps = 0, swaps_missed = 0, swaps_sum_missed = 0;
+  uint32_t random_damage = 0, random_missed = 0, random_sum_missed = 0;
+
+  for(int trial = 0; trial < 20; trial++) {
+    m = random_message();
+    encode_radio_message(&m, good);
+
+    for(int i = 0; i < bits; i++) {
+      memcpy(packet, good, sizeof(packet));
+      packet[i / 8] ^= 1 << (i % 8);
+      singles++;
+      if(decode_radio_message(packet, RADIO_PACKET_SIZE, &d) == RADIO_DECODE_OK)
+	missed++;
+      for(int j = i + 1; j < bits; j++) {
+	packet[j / 8] ^= 1 << (j % 8);
+	doubles++;
+	if(decode_radio_message(packet, RADIO_PACKET_SIZE, &d) == RADIO_DECODE_OK)
+	  missed++;
+	packet[j / 8] ^= 1 << (j % 8);
+      }
+    }
+
+    // swapped bytes; the CRC is in the packet too, and can be swapped with the rest
+    for(int i = 0; i < RADIO_PACKET_SIZE; i++) {
+      for(int j = i + 1; j < RADIO_PACKET_SIZE; j++) {
+	if(good[i] == good[j])
+	  continue;
+	memcpy(packet, good, sizeof(packet));
+	packet[i] = good[j];
+	packet[j] = good[i];
+	bool accepted = decode_radio_message(packet, RADIO_PACKET_SIZE, &d) == RADIO_DECODE_OK;
+	if(j == i + 1) {
+	  adjacent++;
+	  if(accepted)
+	    missed++;
+	}
+	swaps++;
+	if(accepted)
+	  swaps_missed++;
+	if(j < RADIO_PACKET_SIZE - 2 && sum8(packet) == sum8(good))
+	  swaps_sum_missed++;
+      }
+    }
+
+    // a few random bytes trashed
+    for(int k = 0; k < 5000; k++) {
+      memcpy(packet, good, sizeof(packet));
+      int count = 2 + test_random(4);
+      for(int n = 0; n < count; n++)
+	packet[test_random(RADIO_PACKET_SIZE - 2)] ^= 1 + test_random(255);
+      if(!memcmp(packet, good, sizeof(packet)))
+	continue;
+      random_damage++;
+      if(decode_radio_message(packet, RADIO_PACKET_SIZE, &d) == RADIO_DECODE_OK)
+	random_missed++;
+      if(sum8(packet) == sum8(good))
+	random_sum_missed++;
+    }
+  }
+
+  printf("%u single-bit, %u two-bit, %u adjacent swaps: %u accepted\n",
+	 singles, doubles, adjacent, missed);
+  printf("%u byte swaps: CRC-16 accepted %u, an 8-bit sum would accept %u\n",
+	 swaps, swaps_missed, swaps_sum_missed);
+  printf("%u random damage: CRC-16 accepted %u, an 8-bit sum would accept %u\n",
+	 random_damage, random_missed, random_sum_missed);
+  CHECK(missed == 0);
+  CHECK(random_missed * 1000 < random_damage); // about 1 in 65536
+}
+
+static void test_ack() {
+  for(int trial = 0; trial < 1000; trial++) {
+    struct radio_ack a, d;
+    a.message_serial_number = test_random(0x10000);
+    a.send_micros = test_random(0x1000000) * 251;
+    a.receive_micros = test_random(0x1000000) * 253;
+    a.listener_id = test_random(4);
+    a.accepted_serial = test_random(0x10000);
+    a.displayed_centis = (int16_t)(test_random(10200) - 200);
+    a.flags = test_random(2) ? LISTENER_FLAG_RUNNING : 0;
+    a.loop_max_micros = test_random(0x10000);
+    a.celsius = (int8_t)(test_random(256) - 128);
+    a.reset_cause = test_random(0x10);
+
+    uint8_t payload[RADIO_ACK_SIZE];
+    encode_radio_ack(&a, payload);
+    memset(&d, 0xa5, sizeof(d));
+    CHECK(!decode_radio_ack(payload, RADIO_ACK_SIZE - 1, &d));
+    CHECK(!decode_radio_ack(payload, RADIO_ACK_SIZE + 1, &d));
+    CHECK(decode_radio_ack(payload, RADIO_ACK_SIZE, &d));
+    CHECK(d.message_serial_number == a.message_serial_number);
+    CHECK(d.send_micros == a.send_micros);
+    CHECK(d.receive_micros == a.receive_micros);
+    CHECK(d.listener_id == a.listener_id);
+    CHECK(d.accepted_serial == a.accepted_serial);
+    CHECK(d.displayed_centis == a.displayed_centis);
+    CHECK(d.flags == a.flags);
+    CHECK(d.loop_max_micros == a.loop_max_micros);
+    CHECK(d.celsius == a.celsius);
+    CHECK(d.reset_cause == a.reset_cause);
+    if(g_test_failures)
+      return;
+  }
+}
+
+int main() {
+  test_round_trip();
+  test_framing();
+  test_corruption();
+  test_ack();
+  return test_result("radio-packet");
+}
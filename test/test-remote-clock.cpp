@@ -0,0 +1,166 @@
+/*
+  MIT License
+
+  Copyright (c) 2022 Delta Z Technical Services, LLC, Austin, TX.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  A listener's remote clock fed through a lossy multicast link.  The broadcaster counts
+  down from 24 s and sends the time whenever its display changes (each second, then each
+  tenth under 10 s), RADIO_MULTICAST_COPIES copies a millisecond apart, each stamped
+  afresh.  Every copy is lost at random, and the ones that get through arrive up to a
+  millisecond late, uncompensated.  The listener's resonator runs fast or slow, and its
+  loop passes come a few milliseconds apart, which is when it drains the radio, corrects
+  and advances the clock, and shows it.
+
+  While running, what the listener shows must never count back up, and must stay within
+  a few milliseconds of the broadcaster.
+*/
+
+#include <vector>
+#include <algorithm>
+#include "test.h"
+#include "remote-clock.h"
+
+#define RADIO_MULTICAST_COPIES 3
+#define START_MILLIS 24000
+#define MAX_LOOP_MILLIS 6 // a pass that redraws the front digits
+#define MAX_ERROR_MILLIS 10
+
+struct arrival {
+  uint32_t micros; // true time it is in the listener's FIFO
+  int32_t clock_millis;
+};
+
+static int32_t displayed(int32_t clock_millis) {
+  // what the broadcaster's front digits show: a change there sends a packet
+  if(clock_millis >= 10000)
+    return (clock_millis + 999) / 1000;
+  return 100 + (clock_millis + 99) / 100;
+}
+
+struct run_stats {
+  uint32_t sent, received, passes, backwards;
+  double error_sum;
+  int32_t error_max;
+  std::vector<int32_t> errors;
+};
+
+static void run(unsigned loss_percent, int32_t drift_ppm, struct run_stats *stats) {
+  *stats = run_stats();
+
+  // the broadcaster, in true microseconds
+  std::vector<arrival> air;
+  int32_t last_displayed = -1;
+  for(uint32_t t = 0; t <= (uint32_t)START_MILLIS * 1000; t += 1000) {
+    int32_t clock_millis = START_MILLIS - t / 1000;
+    if(displayed(clock_millis) == last_displayed)
+      continue;
+    last_displayed = displayed(clock_millis);
+    for(int copy = 0; copy < RADIO_MULTICAST_COPIES; copy++) {
+      stats->sent++;
+      if(test_random(100) < loss_percent)
+	continue;
+      uint32_t sent = t + copy * 1000;
+      struct arrival a = { sent + 300 + test_random(1000), START_MILLIS - (int32_t)(sent / 1000) };
+      air.push_back(a);
+    }
+  }
+
+  // the listener: its own millis() runs drift_ppm off true time
+  struct remote_clock clock;
+  memset(&clock, 0, sizeof(clock));
+  size_t next = 0;
+  bool synced = false;
+  int32_t last_shown = 0;
+  for(uint32_t t = 0; t < (uint32_t)START_MILLIS * 1000; t += 1000 * (1 + test_random(MAX_LOOP_MILLIS))) {
+    uint32_t now_millis = (uint32_t)(t / 1000 + (int64_t)t * drift_ppm / 1000000000LL);
+    bool have_time = false;
+    int32_t newest = 0;
+    while(next < air.size() && air[next].micros <= t) {
+      newest = air[next++].clock_millis;
+      have_time = true;
+      stats->received++;
+    }
+    if(have_time)
+      correct_remote_clock(&clock, now_millis, newest, true);
+    else
+      advance_remote_clock(&clock, now_millis);
+    if(!clock.running)
+      continue;
+
+    int32_t truth = START_MILLIS - (int32_t)(t / 1000);
+    int32_t error = clock.millis - truth;
+    if(synced) {
+      if(clock.millis > last_shown)
+	stats->backwards++;
+      stats->passes++;
+      stats->error_sum += error;
+      stats->error_max = std::max(stats->error_max, error < 0 ? -error : error);
+      stats->errors.push_back(error < 0 ? -error : error);
+    }
+    synced = true;
+    last_shown = clock.millis;
+  }
+  std::sort(stats->errors.begin(), stats->errors.end());
+}
+
+static void test_lossy_link(unsigned loss_percent, int32_t drift_ppm) {
+  struct run_stats stats;
+  run(loss_percent, drift_ppm, &stats);
+  printf("loss %2u%%, drift %+5ld ppm: %4u/%4u copies, error mean %+.1f ms p99 %ld ms max %ld ms, %u backwards\n",
+	 loss_percent, (long)drift_ppm, stats.received, stats.sent, stats.error_sum / stats.passes,
+	 (long)stats.errors[stats.errors.size() * 99 / 100], (long)stats.error_max, stats.backwards);
+  CHECK(stats.backwards == 0);
+  CHECK(stats.error_max <= MAX_ERROR_MILLIS);
+}
+
+static void test_snap() {
+  // time+ and time- are taken at once, not slewed; small errors are slewed at 1/8
+  struct remote_clock clock;
+  memset(&clock, 0, sizeof(clock));
+  correct_remote_clock(&clock, 0, 20000, true);
+  CHECK(clock.millis == 20000 && clock.snaps == 1);
+
+  correct_remote_clock(&clock, 1000, 19000 + 5000, true);
+  CHECK(clock.millis == 24000 && clock.snaps == 2);
+
+  correct_remote_clock(&clock, 2000, 23000 - 80, true);
+  CHECK(clock.millis == 23000 && clock.slew_millis == -80 && clock.snaps == 2);
+  advance_remote_clock(&clock, 2400);
+  CHECK(clock.millis == 23000 - 400 - 50 && clock.slew_millis == -30);
+  advance_remote_clock(&clock, 2800);
+  CHECK(clock.millis == 23000 - 800 - 80 && clock.slew_millis == 0);
+
+  correct_remote_clock(&clock, 3000, 22400, false);
+  CHECK(clock.millis == 22400 && !clock.running);
+  advance_remote_clock(&clock, 9000);
+  CHECK(clock.millis == 22400);
+}
+
+int main() {
+  test_snap();
+  static const int32_t drifts[] = { -2000, -500, 0, 500, 2000 };
+  for(unsigned loss = 0; loss <= 30; loss += 30)
+    for(unsigned d = 0; d < sizeof(drifts) / sizeof(drifts[0]); d++)
+      test_lossy_link(loss, drifts[d]);
+  return test_result("remote-clock");
+}
@@ -0,0 +1,199 @@
+/*
+  MIT License
+
+  Copyright (c) 2022 Delta Z Technical Services, LLC, Austin, TX.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Zero-to-horn latency, simulated.  The countdown and the horn relay run from the 1 kHz
+  Timer1 tick, but a front show() holds interrupts off for about 1.5 ms a digit.  The
+  tick that reaches zero can land inside a show: the first compare match in it runs the
+  ISR as soon as interrupts are back on, and show_front_digit() replays the rest
+  (missed-ticks.h).  Either way the relay waits for the show to end, so the latency is
+  bounded by the longest show, not by one tick.
+
+  The loop is as in test-horn-timing: mostly short passes, some long ones, and a
+  two-digit front refresh every 20 ms.  Half the countdowns are set to reach zero inside
+  a show, the worst case.  Latency runs from when the zero tick was due to the relay
+  going on; for comparison, loop() only notices zero at the end of the pass it lands in.
+*/
+
+#include <vector>
+#include "test.h"
+#include "missed-ticks.h"
+#include "countdown.h"
+
+#define TRIALS 4000
+#define TIMELINE_MICROS 300000
+#define MAX_COUNTDOWN_MILLIS 200
+#define REFRESH_MICROS 20000
+#define SHOW_MICROS 1500 // one 50-pixel RGB digit
+#define FRONT_DIGITS 2
+
+struct interval {
+  uint32_t start;
+  uint32_t end;
+};
+
+struct trial {
+  uint32_t started; // micros, the clock started at the end of a pass
+  std::vector<uint32_t> pass_ends;
+  std::vector<struct interval> shows; // interrupts off
+};
+
+static uint32_t pass_micros() {
+  uint32_t r = test_random(100);
+  if(r < 70)
+    return 1000 + test_random(2000);
+  if(r < 95)
+    return 5000 + test_random(15000);
+  return 30000 + test_random(30000);
+}
+
+static void make_trial(struct trial *t) {
+  uint32_t now = test_random(1000000); // any phase against the tick
+  uint32_t next_refresh = now + test_random(REFRESH_MICROS);
+  t->started = now;
+  t->pass_ends.push_back(now);
+  while(now < t->started + TIMELINE_MICROS) {
+    now += pass_micros();
+    if(now >= next_refresh) {
+      for(int digit = 0; digit < FRONT_DIGITS; digit++) {
+	struct interval show = { now, now + SHOW_MICROS + test_random(20) };
+	t->shows.push_back(show);
+	now = show.end + 10;
+      }
+      next_refresh += REFRESH_MICROS;
+    }
+    t->pass_ends.push_back(now);
+  }
+}
+
+static uint32_t first_tick(const struct trial *t) {
+  return (t->started / 1000 + 1) * 1000;
+}
+
+static int32_t countdown_millis(const struct trial *t) {
+  // half the time aim the zero tick into a show that comes after the first tick
+  if(test_random(2) == 0) {
+    for(int tries = 0; tries < 10; tries++) {
+      const struct interval *s = &t->shows[test_random(t->shows.size())];
+      uint32_t due = (s->start + test_random(s->end - s->start)) / 1000 * 1000;
+      if(due >= s->start && due >= first_tick(t) &&
+	 due < first_tick(t) + MAX_COUNTDOWN_MILLIS * 1000)
+	return (due - first_tick(t)) / 1000 + 1;
+    }
+  }
+  return 1 + test_random(MAX_COUNTDOWN_MILLIS);
+}
+
+/* Timer1 against the shows, as in test-horn-timing; sets when the zero tick was due */
+static uint32_t relay_on_micros(const struct trial *t, int32_t millis, uint32_t *due) {
+  volatile struct countdown countdown = { millis, 0, true, false };
+  uint32_t tick = first_tick(t);
+  size_t show = 0;
+  for(;;) {
+    while(show < t->shows.size() && t->shows[show].end <= tick)
+      show++;
+    if(show < t->shows.size() && t->shows[show].start <= tick) {
+      // the pending match runs at the end of the show, then the lost ones are replayed
+      const struct interval *s = &t->shows[show];
+      uint32_t matches = s->end / 1000 - s->start / 1000;
+      uint8_t counted = 1 + missed_timer1_ticks((s->start / TIMER1_MICROS_PER_COUNT) % TIMER1_TICK_COUNTS,
+						(s->end / TIMER1_MICROS_PER_COUNT) % TIMER1_TICK_COUNTS,
+						SHOW_MICROS / TIMER1_MICROS_PER_COUNT);
+      for(uint8_t i = 0; i < counted; i++) {
+	if(countdown_step(&countdown, TICK_Q24_NOMINAL)) {
+	  *due = tick + i * 1000;
+	  return s->end;
+	}
+      }
+      tick += matches * 1000;
+    } else {
+      if(countdown_step(&countdown, TICK_Q24_NOMINAL)) {
+	*due = tick;
+	return tick;
+      }
+      tick += 1000;
+    }
+  }
+}
+
+static uint32_t noticed_micros(const struct trial *t, uint32_t relay_on) {
+  for(size_t i = 0; i < t->pass_ends.size(); i++) {
+    if(t->pass_ends[i] >= relay_on)
+      return t->pass_ends[i];
+  }
+  return t->pass_ends.back();
+}
+
+struct latency_stats {
+  int64_t total;
+  int32_t min;
+  int32_t max;
+};
+
+static void add_latency(struct latency_stats *stats, int32_t latency) {
+  stats->total += latency;
+  if(latency < stats->min)
+    stats->min = latency;
+  if(latency > stats->max)
+    stats->max = latency;
+}
+
+static void print_latency(const char *name, const struct latency_stats *stats, int count) {
+  printf("  %-22s mean %6.2f ms, min %6.2f ms, max %6.2f ms\n", name,
+	 count ? stats->total / 1000.0 / count : 0.0, stats->min / 1000.0, stats->max / 1000.0);
+}
+
+int main() {
+  struct latency_stats relay = { 0, INT32_MAX, INT32_MIN };
+  struct latency_stats relay_in_show = { 0, INT32_MAX, INT32_MIN };
+  struct latency_stats noticed = { 0, INT32_MAX, INT32_MIN };
+  int in_show = 0;
+  for(int i = 0; i < TRIALS; i++) {
+    struct trial t;
+    make_trial(&t);
+    int32_t millis = countdown_millis(&t);
+    uint32_t due = 0;
+    uint32_t relay_on = relay_on_micros(&t, millis, &due);
+    // the zero tick is the one the count says, shows or not
+    CHECK(due == first_tick(&t) + (uint32_t)(millis - 1) * 1000);
+    add_latency(&relay, relay_on - due);
+    if(relay_on != due) {
+      add_latency(&relay_in_show, relay_on - due);
+      in_show++;
+    }
+    add_latency(&noticed, noticed_micros(&t, relay_on) - due);
+  }
+  printf("Zero-to-horn latency over %d countdowns, %d of them reaching zero in a show:\n",
+	 TRIALS, in_show);
+  print_latency("relay, all", &relay, TRIALS);
+  print_latency("relay, zero in a show", &relay_in_show, in_show);
+  print_latency("loop() noticing zero", &noticed, TRIALS);
+
+  // held off by at most one show, never by a whole refresh or a long pass
+  CHECK(in_show > TRIALS / 4);
+  CHECK(relay.min >= 0);
+  CHECK(relay.max <= SHOW_MICROS + 30);
+  CHECK(noticed.max > relay.max);
+  return test_result("zero-to-horn");
+}
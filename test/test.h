@@ -0,0 +1,58 @@
+/*
+  MIT License
+
+  Copyright (c) 2022 Delta Z Technical Services, LLC, Austin, TX.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Host tests for the hardware-free parts of the clock: build and run them all with
+  "make" in this directory.  Each test is a plain program; CHECK() counts failures and
+  test_result() turns them into the exit status.  Measurements are printed, not checked
+  against exact numbers, except where the design promises a bound.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int g_test_failures = 0;
+
+#define CHECK(condition)						\
+  do {									\
+    if(!(condition)) {							\
+      printf("%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+      g_test_failures++;						\
+    }									\
+  } while(0)
+
+static inline int test_result(const char *name) {
+  printf("%s: %s\n", name, g_test_failures ? "FAILED" : "ok");
+  return g_test_failures ? 1 : 0;
+}
+
+/* a repeatable pseudo-random sequence, the same on every host */
+static uint32_t g_test_random = 1;
+
+static inline uint32_t test_random(uint32_t limit) {
+  g_test_random = g_test_random * 1103515245 + 12345;
+  return (g_test_random >> 8) % limit;
+}
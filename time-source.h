@@ -0,0 +1,70 @@
+/*
+  MIT License
+
+  Copyright (c) 2022 Delta Z Technical Services, LLC, Austin, TX.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+/*
+  Where "now" comes from.  On the clock that is millis() and micros(), and Timer1 runs
+  the 1 kHz tick, countdown_tick().  A host build defines SIMULATED_TIME before including
+  this, and time stands still until advance_simulated_time() moves it, calling the tick
+  function on every whole millisecond crossed, as Timer1's compare match would.  Whole
+  games then run as fast as the host can go.
+*/
+
+#ifdef SIMULATED_TIME
+
+struct simulated_time {
+  uint32_t millis; // each wraps on its own, as millis() and micros() do
+  uint32_t micros;
+  uint16_t micros_to_tick; // to the next whole millisecond
+  void (*tick)(void); // the 1 kHz tick: countdown_tick() on the clock
+};
+
+static struct simulated_time g_simulated_time = { 0, 0, 1000, 0 };
+
+#define time_source_millis() (g_simulated_time.millis)
+#define time_source_micros() (g_simulated_time.micros)
+
+static inline void advance_simulated_time(uint32_t elapsed_micros) {
+  while(elapsed_micros > 0) {
+    uint16_t to_tick = g_simulated_time.micros_to_tick;
+    if(elapsed_micros < to_tick) {
+      g_simulated_time.micros += elapsed_micros;
+      g_simulated_time.micros_to_tick -= elapsed_micros;
+      return;
+    }
+    g_simulated_time.micros += to_tick;
+    g_simulated_time.millis++;
+    g_simulated_time.micros_to_tick = 1000;
+    elapsed_micros -= to_tick;
+    if(g_simulated_time.tick)
+      g_simulated_time.tick();
+  }
+}
+
+#else
+
+#define time_source_millis() millis()
+#define time_source_micros() micros()
+
+#endif